@@ -0,0 +1,10 @@
+#version 150
+// ^ Change this to version 130 if you have compatibility issues
+
+// Refer to the lambert shader files for useful comments
+
+// Nothing to shade, the depth is written by the fixed-function pipeline
+
+void main()
+{
+}
@@ -0,0 +1,29 @@
+#version 150
+// ^ Change this to version 130 if you have compatibility issues
+
+// Refer to the lambert shader files for useful comments
+
+// Writes only depth, for the depth prepass of the opaque terrain.
+// The position must come out bit for bit the same as in lambert.vert.glsl,
+// so that the color pass can test against the prepass's depth.
+
+uniform mat4 u_Model;
+
+in vec4 vs_Pos;
+
+// The camera and the time, shared by all shaders for the whole frame
+// (FrameUniforms in frameuniforms.h). u_Time increases constantly and is
+// updated in MyGL::tick().
+layout(std140) uniform FrameUniforms {
+    mat4 u_ViewProj;    // The matrix that defines the camera's transformation.
+    vec4 u_CameraPos;   // The camera's position in world space
+    float u_Time;
+};
+
+invariant gl_Position;
+
+void main()
+{
+    vec4 modelposition = u_Model * vs_Pos;
+    gl_Position = u_ViewProj * modelposition;
+}
@@ -7,10 +7,6 @@
 //This simultaneous transformation allows your program to run much faster, especially when rendering
 //geometry with millions of vertices.
 
-uniform mat4 u_ViewProj;    // The matrix that defines the camera's transformation.
-                            // We've written a static matrix for you to use for HW2,
-                            // but in HW3 you'll have to generate one yourself
-
 in vec4 vs_Pos;             // The array of vertex positions passed to the shader
 in vec4 vs_Nor;             // The array of vertex normals passed to the shader
 
@@ -31,8 +27,14 @@ out vec2 fs_UV;
 in float vs_Animated;
 out float fs_Animated;
 
-// A constantly-increasing value updated in MyGL::tick()
-uniform float u_Time;
+// The camera and the time, shared by all shaders for the whole frame
+// (FrameUniforms in frameuniforms.h). u_Time increases constantly and is
+// updated in MyGL::tick().
+layout(std140) uniform FrameUniforms {
+    mat4 u_ViewProj;    // The matrix that defines the camera's transformation.
+    vec4 u_CameraPos;   // The camera's position in world space
+    float u_Time;
+};
 
 void main()
 {
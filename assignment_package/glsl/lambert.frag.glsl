@@ -23,8 +23,14 @@ in vec4 fs_Col;
 uniform sampler2D u_Texture;
 in vec2 fs_UV;
 
-// A constantly-increasing value updated in MyGL::tick()
-uniform float u_Time;
+// The camera and the time, shared by all shaders for the whole frame
+// (FrameUniforms in frameuniforms.h). u_Time increases constantly and is
+// updated in MyGL::tick().
+layout(std140) uniform FrameUniforms {
+    mat4 u_ViewProj;    // The matrix that defines the camera's transformation.
+    vec4 u_CameraPos;   // The camera's position in world space
+    float u_Time;
+};
 
 in float fs_Animated;
 
@@ -0,0 +1,376 @@
+#include "benchmark.h"
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <random>
+#include <vector>
+#include <QThread>
+#include <QThreadPool>
+#include "scene/camera.h"
+#include "scene/chunk.h"
+#include "scene/chunkmap.h"
+#include "scene/chunkscheduler.h"
+#include "scene/cullingboxes.h"
+#include "scene/renderregions.h"
+#include "scene/terrain.h"
+#include "scene/generationpipeline.h"
+#include "scene/workstealingpool.h"
+#include "smartpointerhelp.h"
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+// Generates one chunk into its own buffer. The jobs don't auto-delete,
+// so the same job objects are reused for every run.
+class GenerateChunkJob : public QRunnable {
+public:
+    GenerateChunkJob(int x, int z)
+        : mp_pipeline(nullptr), m_x(x), m_z(z), m_blocks(65536)
+    {
+        setAutoDelete(false);
+    }
+    void setPipeline(GenerationPipeline* pipeline) {
+        mp_pipeline = pipeline;
+    }
+    void run() override {
+        mp_pipeline->generate(m_blocks.data(), m_x, m_z, ALL_GENERATION_STAGES);
+    }
+
+private:
+    GenerationPipeline* mp_pipeline;
+    int m_x, m_z;
+    std::vector<BlockType> m_blocks;
+};
+
+// Generate every chunk of the zones with the given pool and
+// return the throughput in chunks per second
+template <typename Pool, typename Submit>
+double generateZones(std::vector<uPtr<GenerateChunkJob>>& jobs, Pool& pool, Submit submit) {
+    // Fresh caches, so every run builds the noise tiles again
+    NoiseTileCache noiseTiles(64);
+    RiverRegistry rivers;
+    GenerationPipeline pipeline(&noiseTiles, &rivers);
+    for (uPtr<GenerateChunkJob>& job : jobs) {
+        job->setPipeline(&pipeline);
+    }
+
+    Clock::time_point start = Clock::now();
+    submit(pool, jobs);
+    pool.waitForDone();
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    return jobs.size() / seconds;
+}
+
+void benchmarkWorkerPools(std::ostream& os) {
+    // 4 x 4 zones of 4 x 4 chunks each
+    const int zonesPerSide = 4;
+    // QRunnables can't be copied or moved, so the jobs are held by pointer
+    std::vector<uPtr<GenerateChunkJob>> jobs;
+    for (int x = 0; x < zonesPerSide * 64; x += 16) {
+        for (int z = 0; z < zonesPerSide * 64; z += 16) {
+            jobs.push_back(mkU<GenerateChunkJob>(x, z));
+        }
+    }
+    BiomeNoise::setSeed(1);
+
+    os << "Zone generation throughput (" << jobs.size() << " chunks, chunks/s)" << std::endl;
+    os << "threads  QThreadPool  WorkStealingPool  WorkStealingPool (pinned)" << std::endl;
+    int maxThreads = QThread::idealThreadCount();
+    for (int threads = 1; threads <= maxThreads; threads *= 2) {
+        QThreadPool qtPool;
+        qtPool.setMaxThreadCount(threads);
+        double qt = generateZones(jobs, qtPool, [](QThreadPool& pool, std::vector<uPtr<GenerateChunkJob>>& jobs) {
+            for (uPtr<GenerateChunkJob>& job : jobs) {
+                pool.start(job.get());
+            }
+        });
+
+        auto submitBatch = [](WorkStealingPool& pool, std::vector<uPtr<GenerateChunkJob>>& jobs) {
+            std::vector<QRunnable*> batch;
+            for (uPtr<GenerateChunkJob>& job : jobs) {
+                batch.push_back(job.get());
+            }
+            pool.startBatch(batch);
+        };
+        WorkStealingPool stealingPool(threads);
+        double stealing = generateZones(jobs, stealingPool, submitBatch);
+        WorkStealingPool pinnedPool(threads, true);
+        double pinned = generateZones(jobs, pinnedPool, submitBatch);
+
+        os << threads << "\t " << qt << "\t      " << stealing << "\t\t" << pinned << std::endl;
+        if (threads < maxThreads && threads * 2 > maxThreads) {
+            // Always include the full thread count
+            threads = maxThreads / 2;
+        }
+    }
+}
+
+// Milliseconds per call of fn, averaged over the given number of calls
+template <typename Fn>
+double timeFrames(int frames, Fn fn) {
+    Clock::time_point start = Clock::now();
+    for (int i = 0; i < frames; ++i) {
+        fn();
+    }
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count() / frames;
+}
+
+// The CPU side of Terrain::draw with the chunks of a large generation
+// distance resident. The loops mirror the ones in draw() and run on the
+// real ChunkMap, Chunk, RenderRegions and ChunkScheduler, without GL: no
+// chunk has a mesh, so the upload and draw loops only check each chunk's
+// state. The cull+LOD columns are the scan over every chunk that the
+// render regions replaced, with the planes extracted for every chunk as
+// isInView did then.
+void benchmarkDrawLoops(std::ostream& os) {
+    const int frames = 50;
+    os << "Terrain::draw CPU loops (ms per frame, " << frames << " frames)" << std::endl;
+    os << "radius  chunks  visible  snapshot  cull+LOD (before)  cull+LOD  regions: rebuild  cull"
+       << "  rescore  schedule  upload+draw" << std::endl;
+    // 8 and 10 zones of 4 chunks, the largest generation distances
+    for (int radius : {32, 40}) {
+        NoiseTileCache noiseTiles((2 * radius / 4 + 2) * (2 * radius / 4 + 2));
+        RiverRegistry rivers;
+        GenerationPipeline pipeline(&noiseTiles, &rivers);
+        BiomeNoise::setSeed(1);
+
+        // Chunks with block data (no stages run, the loops don't read
+        // the blocks), linked to their neighbors like loaded zones
+        ChunkMap chunks;
+        int side = 2 * radius + 1;
+        std::vector<Chunk*> grid(side * side);
+        for (int x = 0; x < side; ++x) {
+            for (int z = 0; z < side; ++z) {
+                int minX = (x - radius) * 16, minZ = (z - radius) * 16;
+                uPtr<Chunk> chunk = mkU<Chunk>(nullptr, minX, minZ, &pipeline, nullptr);
+                chunk->generate(0);
+                chunk->finishGeneration();
+                grid[x * side + z] = chunks.insert(toKey(minX, minZ), std::move(chunk)).first;
+                if (x > 0) {
+                    grid[x * side + z]->linkNeighbor(grid[(x - 1) * side + z], XNEG);
+                }
+                if (z > 0) {
+                    grid[x * side + z]->linkNeighbor(grid[x * side + z - 1], ZNEG);
+                }
+            }
+        }
+
+        // The player stands in the middle, the view distance is the radius
+        glm::vec3 playerPosition(8.f, 128.f, 8.f);
+        glm::vec2 playerXZ(playerPosition.x, playerPosition.z);
+        Camera camera(1920, 1080, playerPosition);
+        const float viewDistance = radius * 16.f;
+        const float LOD1_DISTANCE = viewDistance * 0.25f;
+        const float LOD2_DISTANCE = viewDistance * 0.5f;
+
+        std::vector<Chunk*> chunkList;
+        double snapshot = timeFrames(frames, [&]() {
+            chunks.snapshot(chunkList);
+        });
+
+        // Before: plain distances and fresh lists every frame,
+        // with every chunk out of range collected for destruction
+        std::vector<Chunk*> chunksToDraw;
+        double cullBefore = timeFrames(frames, [&]() {
+            std::vector<Chunk*> toDraw, toDestroy;
+            for (Chunk* chunk : chunkList) {
+                if (!chunk->hasBlockData()) {
+                    continue;
+                }
+                float distance = glm::distance(chunk->getCenter(), playerXZ);
+                if (distance < viewDistance) {
+                    if (!chunk->isInView(camera.getFrustumPlanes())) {
+                        continue;
+                    }
+                    int lodLevel = distance > LOD2_DISTANCE ? 2 : distance > LOD1_DISTANCE ? 1 : 0;
+                    chunk->setLevelOfDetail(lodLevel);
+                    toDraw.push_back(chunk);
+                } else {
+                    toDestroy.push_back(chunk);
+                }
+            }
+            chunksToDraw.swap(toDraw);
+        });
+
+        // Now: squared distances and reused lists
+        std::vector<Chunk*> chunksToDestroy;
+        const float LOD1_DISTANCE2 = LOD1_DISTANCE * LOD1_DISTANCE;
+        const float LOD2_DISTANCE2 = LOD2_DISTANCE * LOD2_DISTANCE;
+        const float MAX_VIEW_DISTANCE2 = viewDistance * viewDistance;
+        double cull = timeFrames(frames, [&]() {
+            chunksToDraw.clear();
+            chunksToDestroy.clear();
+            for (Chunk* chunk : chunkList) {
+                if (!chunk->hasBlockData()) {
+                    continue;
+                }
+                glm::vec2 offset = chunk->getCenter() - playerXZ;
+                float distance2 = glm::dot(offset, offset);
+                if (distance2 < MAX_VIEW_DISTANCE2) {
+                    if (!chunk->isInView(camera.getFrustumPlanes())) {
+                        continue;
+                    }
+                    int lodLevel = distance2 > LOD2_DISTANCE2 ? 2 : distance2 > LOD1_DISTANCE2 ? 1 : 0;
+                    chunk->setLevelOfDetail(lodLevel);
+                    chunksToDraw.push_back(chunk);
+                } else if (chunk->hasGPUData()) {
+                    chunksToDestroy.push_back(chunk);
+                }
+            }
+        });
+
+        // Render regions: rebuilt when the player enters another chunk,
+        // and culled as a whole region where possible every frame
+        std::array<glm::vec4, 6> frustumPlanes = camera.getFrustumPlanes();
+        RenderRegions regions;
+        double rebuild = timeFrames(frames, [&]() {
+            regions.rebuild(chunkList, playerXZ, viewDistance, LOD1_DISTANCE, LOD2_DISTANCE);
+        });
+        std::vector<Chunk*> visible;
+        double collect = timeFrames(frames, [&]() {
+            visible.clear();
+            regions.collectVisible(frustumPlanes, visible);
+        });
+
+        // Every visible chunk waits for its mesh, as right after the
+        // distance was raised. The pool never gets the jobs.
+        WorkStealingPool pool(1);
+        ChunkScheduler scheduler(&pool);
+        for (Chunk* chunk : chunksToDraw) {
+            scheduler.schedule(chunk, ChunkScheduler::MESH, glm::distance(chunk->getCenter(), playerXZ));
+        }
+        // What draw() did on every frame before, and now only
+        // does when the player enters another chunk or turns
+        double rescore = timeFrames(frames, [&]() {
+            scheduler.updatePriorities([&](const Chunk* chunk, ChunkScheduler::JobKind) {
+                float priority = glm::distance(chunk->getCenter(), playerXZ);
+                if (!chunk->isInView(frustumPlanes)) {
+                    priority += viewDistance;
+                }
+                return priority;
+            });
+            scheduler.cancelIf([&](const Chunk* chunk, ChunkScheduler::JobKind kind) {
+                return kind == ChunkScheduler::MESH
+                       && glm::distance(chunk->getCenter(), playerXZ) >= viewDistance;
+            });
+        });
+
+        double schedule = timeFrames(frames, [&]() {
+            for (Chunk* chunk : chunksToDraw) {
+                if (chunk->needsUpdate() && !scheduler.isScheduled(chunk, ChunkScheduler::MESH)) {
+                    scheduler.schedule(chunk, ChunkScheduler::MESH, glm::distance(chunk->getCenter(), playerXZ));
+                }
+            }
+        });
+
+        // Counted so that the state checks aren't optimized away
+        size_t drawable = 0;
+        double uploadDraw = timeFrames(frames, [&]() {
+            for (Chunk* chunk : chunksToDraw) {
+                if (chunk->hasVBOData()) {
+                    drawable++;
+                }
+            }
+            for (Chunk* chunk : chunksToDraw) {
+                if (chunk->hasGPUData()) {
+                    drawable++;
+                }
+            }
+        });
+        (void)drawable;
+
+        os << radius << "\t" << chunkList.size() << "\t" << chunksToDraw.size() << "\t " << snapshot
+           << "\t   " << cullBefore << "\t\t      " << cull << "\t " << rebuild << "\t   " << collect
+           << "\t " << rescore << "\t   " << schedule
+           << "\t     " << uploadDraw << std::endl;
+        scheduler.cancelIf([](const Chunk*, ChunkScheduler::JobKind) { return true; });
+    }
+}
+
+// The scalar box test Chunk::isInView does
+bool boxInFrustum(const std::array<glm::vec4, 6>& planes, const glm::vec3& minCorner, const glm::vec3& maxCorner) {
+    for (const glm::vec4& plane : planes) {
+        glm::vec3 positive(plane.x >= 0.f ? maxCorner.x : minCorner.x,
+                           plane.y >= 0.f ? maxCorner.y : minCorner.y,
+                           plane.z >= 0.f ? maxCorner.z : minCorner.z);
+        if (glm::dot(plane, glm::vec4(positive, 1.f)) < 0.f) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Time the frustum test of chunk sized boxes, planes extracted per box
+// (as isInView used to), planes extracted once with the scalar test,
+// and the batched CullingBoxes
+void benchmarkFrustumCulling(std::ostream& os) {
+    // 100 x 100 chunks around the camera, with heights like generated terrain
+    const int chunksPerSide = 100;
+    const int runs = 200;
+    std::mt19937 rng(1);
+    std::uniform_int_distribution<int> bottom(0, 60);
+    std::uniform_int_distribution<int> top(130, 220);
+    std::vector<std::pair<glm::vec3, glm::vec3>> boxes;
+    CullingBoxes batch;
+    for (int x = -chunksPerSide / 2; x < chunksPerSide / 2; ++x) {
+        for (int z = -chunksPerSide / 2; z < chunksPerSide / 2; ++z) {
+            glm::vec3 minCorner(x * 16.f, bottom(rng), z * 16.f);
+            glm::vec3 maxCorner(x * 16.f + 16.f, top(rng), z * 16.f + 16.f);
+            boxes.emplace_back(minCorner, maxCorner);
+            batch.add(minCorner, maxCorner);
+        }
+    }
+    Camera camera(1280, 720, glm::vec3(8.f, 160.f, 8.f));
+    std::vector<uint8_t> visible(boxes.size());
+
+    auto time = [&](auto&& cull) {
+        size_t count = 0;
+        Clock::time_point start = Clock::now();
+        for (int run = 0; run < runs; ++run) {
+            count += cull();
+        }
+        double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        return std::make_pair(seconds * 1e9 / (static_cast<double>(runs) * boxes.size()), count / runs);
+    };
+    auto perBox = time([&]() {
+        size_t count = 0;
+        for (const auto& box : boxes) {
+            count += boxInFrustum(camera.getFrustumPlanes(), box.first, box.second);
+        }
+        return count;
+    });
+    auto once = time([&]() {
+        std::array<glm::vec4, 6> planes = camera.getFrustumPlanes();
+        size_t count = 0;
+        for (const auto& box : boxes) {
+            count += boxInFrustum(planes, box.first, box.second);
+        }
+        return count;
+    });
+    auto batched = time([&]() {
+        std::array<glm::vec4, 6> planes = camera.getFrustumPlanes();
+        batch.cull(planes, 0, batch.size(), visible.data());
+        size_t count = 0;
+        for (uint8_t v : visible) {
+            count += v;
+        }
+        return count;
+    });
+
+    os << "Frustum culling (" << boxes.size() << " boxes, ns/box, boxes visible)" << std::endl;
+    os << "planes per box      " << perBox.first << "\t" << perBox.second << std::endl;
+    os << "planes once         " << once.first << "\t" << once.second << std::endl;
+    os << "CullingBoxes batch  " << batched.first << "\t" << batched.second << std::endl;
+}
+
+}
+
+int runBenchmarks(std::ostream& os) {
+    benchmarkWorkerPools(os);
+    os << std::endl;
+    benchmarkDrawLoops(os);
+    os << std::endl;
+    benchmarkFrustumCulling(os);
+    return 0;
+}
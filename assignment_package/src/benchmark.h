@@ -0,0 +1,7 @@
+#pragma once
+#include <ostream>
+
+// Command line benchmarks of the engine systems, run with `--bench`.
+// They don't need a window or OpenGL context.
+// Returns the exit code of the program.
+int runBenchmarks(std::ostream& os);
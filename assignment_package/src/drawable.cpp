@@ -20,8 +20,14 @@ Drawable::~Drawable() {
 
 void Drawable::destroyVBOdata() {
     for(auto &kvp : bufHandles) {
-        mp_context->glDeleteBuffers(1, &(kvp.second));
+        if(bufGenerated[kvp.first]) {
+            mp_context->glDeleteBuffers(1, &(kvp.second));
+        }
     }
+    // Forget the deleted handles, so that destroying the
+    // Drawable afterwards doesn't delete them a second time
+    bufHandles.clear();
+    bufGenerated.clear();
 }
 
 GLenum Drawable::drawMode() {
@@ -0,0 +1,54 @@
+#include "frameuniforms.h"
+
+FrameUniforms::FrameUniforms(OpenGLContext *context)
+    : mp_context(context), m_buffer(0),
+      m_block{glm::mat4(1.f), glm::vec4(0.f, 0.f, 0.f, 1.f), 0.f, {0.f, 0.f, 0.f}},
+      m_dirty(true)
+{}
+
+void FrameUniforms::create() {
+    mp_context->glGenBuffers(1, &m_buffer);
+    mp_context->glBindBuffer(GL_UNIFORM_BUFFER, m_buffer);
+    mp_context->glBufferData(GL_UNIFORM_BUFFER, sizeof(Block), &m_block, GL_DYNAMIC_DRAW);
+    mp_context->glBindBufferBase(GL_UNIFORM_BUFFER, FRAME_UNIFORMS_BINDING, m_buffer);
+    m_dirty = false;
+}
+
+void FrameUniforms::destroy() {
+    if (m_buffer != 0) {
+        mp_context->glDeleteBuffers(1, &m_buffer);
+        m_buffer = 0;
+    }
+    m_dirty = true;
+}
+
+void FrameUniforms::setViewProj(const glm::mat4 &viewProj) {
+    if (m_block.viewProj != viewProj) {
+        m_block.viewProj = viewProj;
+        m_dirty = true;
+    }
+}
+
+void FrameUniforms::setCameraPos(const glm::vec3 &cameraPos) {
+    glm::vec4 position(cameraPos, 1.f);
+    if (m_block.cameraPos != position) {
+        m_block.cameraPos = position;
+        m_dirty = true;
+    }
+}
+
+void FrameUniforms::setTime(float time) {
+    if (m_block.time != time) {
+        m_block.time = time;
+        m_dirty = true;
+    }
+}
+
+void FrameUniforms::upload() {
+    if (!m_dirty || m_buffer == 0) {
+        return;
+    }
+    mp_context->glBindBuffer(GL_UNIFORM_BUFFER, m_buffer);
+    mp_context->glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(Block), &m_block);
+    m_dirty = false;
+}
@@ -0,0 +1,48 @@
+#pragma once
+#include "openglcontext.h"
+#include "glm_includes.h"
+
+// The uniform buffer binding point of the FrameUniforms block
+const GLuint FRAME_UNIFORMS_BINDING = 0;
+
+// The uniforms that are the same for every shader within a frame (the
+// camera and the time), kept in a single uniform buffer. The shaders
+// declare them in the std140 block
+//
+//     layout(std140) uniform FrameUniforms {
+//         mat4 u_ViewProj;
+//         vec4 u_CameraPos;
+//         float u_Time;
+//     };
+//
+// and ShaderProgram::create points every program's block at
+// FRAME_UNIFORMS_BINDING, so the values are uploaded once per frame
+// instead of once per program.
+class FrameUniforms {
+private:
+    // The block in std140 layout
+    struct Block {
+        glm::mat4 viewProj;
+        glm::vec4 cameraPos;
+        float time;
+        float padding[3];
+    };
+
+    OpenGLContext *mp_context;
+    GLuint m_buffer;
+    Block m_block;
+    // Whether m_block changed since the last upload
+    bool m_dirty;
+
+public:
+    FrameUniforms(OpenGLContext *context);
+    // Create the buffer and bind it to FRAME_UNIFORMS_BINDING
+    void create();
+    void destroy();
+
+    void setViewProj(const glm::mat4 &viewProj);
+    void setCameraPos(const glm::vec3 &cameraPos);
+    void setTime(float time);
+    // Send the values to the GPU if any of them changed since the last call
+    void upload();
+};
@@ -1,8 +1,12 @@
 #include <mainwindow.h>
 
 #include <QApplication>
+#include <QCoreApplication>
 #include <QSurfaceFormat>
 #include <QDebug>
+#include <cstring>
+#include <iostream>
+#include "benchmark.h"
 
 void debugFormatVersion()
 {
@@ -21,6 +25,14 @@ void debugFormatVersion()
 
 int main(int argc, char *argv[])
 {
+    // Run the benchmarks without opening a window
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--bench") == 0) {
+            QCoreApplication app(argc, argv);
+            return runBenchmarks(std::cout);
+        }
+    }
+
     QApplication a(argc, argv);
 
     // Set OpenGL 4.0 and, optionally, 4-sample multisampling
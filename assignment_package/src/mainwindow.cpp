@@ -64,12 +64,12 @@ void MainWindow::on_actionQuit_triggered()
 void MainWindow::on_actionSave_triggered() {
     // Make sure that all threads have finished processing before saving
     // (otherwise we may save zones that are still being generated)
-    QThreadPool::globalInstance()->waitForDone();
+    ui->mygl->waitForWorkers();
     ui->mygl->stopGame();
     ui->mygl->triggerSave();
     // Wait for the save to complete before starting the game loop again
     // (otherwise we may modify a world that is being saved)
-    QThreadPool::globalInstance()->waitForDone();
+    ui->mygl->waitForWorkers();
     ui->mygl->startGame();
 }
 
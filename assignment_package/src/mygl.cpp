@@ -11,11 +11,12 @@
 MyGL::MyGL(QWidget *parent)
     : OpenGLContext(parent),
       m_worldAxes(this),
-    m_progLambert(this), m_progFlat(this), m_progInstanced(this), m_progBlinnPhong(this),
+    m_progLambert(this), m_progFlat(this), m_progInstanced(this), m_progBlinnPhong(this), m_progDepth(this),
       m_progPostProcessNoOp(this), m_progPostProcessUnderWater(this), m_progPostProcessUnderLava(this),
       m_selectedPostProcessShader(&m_progPostProcessNoOp),
       m_quadDrawable(this),
       m_postProcessFrameBuffer(this, this->width(), this->height(), this->devicePixelRatio()),
+      m_frameUniforms(this),
       m_terrain(this), m_player(glm::vec3(48.f, 161.f, 48.f), m_terrain),
     currentMSecsSinceEpoch(0), inputBundle(), degY(0.f), m_texture(this), m_underwater(this), m_underlava(this)
 {
@@ -64,6 +65,7 @@ MyGL::MyGL(QWidget *parent)
 MyGL::~MyGL() {
     makeCurrent();
     glDeleteVertexArrays(1, &vao);
+    m_frameUniforms.destroy();
 }
 
 
@@ -109,11 +111,27 @@ void MyGL::initializeGL()
     m_progFlat.create(":/glsl/flat.vert.glsl", ":/glsl/flat.frag.glsl");
     m_progInstanced.create(":/glsl/instanced.vert.glsl", ":/glsl/lambert.frag.glsl");
     m_progBlinnPhong.create(":/glsl/water_wave.vert.glsl", ":/glsl/blinn_phong.frag.glsl");
+    m_progDepth.create(":/glsl/depth.vert.glsl", ":/glsl/depth.frag.glsl");
 
     m_progPostProcessNoOp.create(":/glsl/passthrough.vert.glsl", ":/glsl/noOp.frag.glsl");
     m_progPostProcessUnderWater.create(":/glsl/passthrough.vert.glsl", ":/glsl/underwater.frag.glsl");
     m_progPostProcessUnderLava.create(":/glsl/passthrough.vert.glsl", ":/glsl/underlava.frag.glsl");
 
+    m_frameUniforms.create();
+
+    // The terrain and the world axes are drawn untransformed,
+    // so their model matrices never change
+    m_progLambert.setUnifMat4("u_Model", glm::mat4(1.f));
+    m_progLambert.setUnifMat4("u_ModelInvTr", glm::mat4(1.f));
+    m_progBlinnPhong.setUnifMat4("u_Model", glm::mat4(1.f));
+    m_progBlinnPhong.setUnifMat4("u_ModelInvTr", glm::mat4(1.f));
+    m_progFlat.setUnifMat4("u_Model", glm::mat4(1.f));
+    m_progDepth.setUnifMat4("u_Model", glm::mat4(1.f));
+
+    // SUN / light source
+    m_progBlinnPhong.setUnifVec3("u_CamPos", glm::vec3(40.28f, 321.5f, 2.5f));
+    m_progBlinnPhong.setUnifVec3("u_CamLook", glm::vec3(0.1f, -0.99f, -0.04f));
+
     // texture
     QString texturePath = getCurrentPath() + "/textures/minecraft_textures_all_copy.png";
     std::cout << texturePath.toStdString() << std::endl;
@@ -130,6 +148,7 @@ void MyGL::initializeGL()
     // We have to have a VAO bound in OpenGL 3.2 Core. But if we're not
     // using multiple VAOs, we can just bind one once.
     glBindVertexArray(vao);
+    setDefaultVertexArray(vao);
 
     // m_terrain.CreateTestScene();
 }
@@ -144,10 +163,7 @@ void MyGL::resizeGL(int w, int h) {
 
     // Upload the view-projection matrix to our shaders (i.e. onto the graphics card)
 
-    m_progLambert.setUnifMat4("u_ViewProj", viewproj);
-    m_progFlat.setUnifMat4("u_ViewProj", viewproj);
-    m_progInstanced.setUnifMat4("u_ViewProj", viewproj);
-    m_progBlinnPhong.setUnifMat4("u_ViewProj", viewproj);
+    m_frameUniforms.setViewProj(viewproj);
 
     m_postProcessFrameBuffer.resize(w * this->devicePixelRatio(), h * this->devicePixelRatio(), this->devicePixelRatio());
     m_postProcessFrameBuffer.destroy();
@@ -179,12 +195,7 @@ void MyGL::tick() {
 
     currentMSecsSinceEpoch = currentTime;
 
-    m_progLambert.setUnifFloat("u_Time", currTimeFloat);
-    m_progFlat.setUnifFloat("u_Time", currTimeFloat);
-    m_progInstanced.setUnifFloat("u_Time", currTimeFloat);
-    m_progPostProcessUnderWater.setUnifFloat("u_Time", currTimeFloat);
-    m_progPostProcessUnderLava.setUnifFloat("u_Time", currTimeFloat);
-    m_progBlinnPhong.setUnifFloat("u_Time", currTimeFloat);
+    m_frameUniforms.setTime(currTimeFloat);
 
     m_terrain.generate(m_player.mcr_position);
 
@@ -233,27 +244,16 @@ void MyGL::paintGL() {
     glClearColor(0.37f, 0.74f, 1.0f, 1); // sky color
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-    glm::mat4 viewproj = m_player.mcr_camera.getViewProj();
-    m_progLambert.setUnifMat4("u_ViewProj", viewproj);
-    m_progFlat.setUnifMat4("u_ViewProj", viewproj);
-    m_progInstanced.setUnifMat4("u_ViewProj", viewproj);
-    m_progBlinnPhong.setUnifMat4("u_ViewProj", viewproj);
+    // One upload for all shader programs
+    m_frameUniforms.setViewProj(m_player.mcr_camera.getViewProj());
+    m_frameUniforms.setCameraPos(m_player.mcr_camera.mcr_position);
+    m_frameUniforms.upload();
 
     // Render the terrain
-    m_progLambert.setUnifMat4("u_Model", glm::mat4(1.f));
-    m_progLambert.setUnifMat4("u_ModelInvTr", glm::inverse(glm::transpose(glm::mat4(1.f))));
-    m_progBlinnPhong.setUnifMat4("u_Model", glm::mat4(1.f));
-    m_progBlinnPhong.setUnifMat4("u_ModelInvTr", glm::inverse(glm::transpose(glm::mat4(1.f))));
-
-    // SUN / light source
-    m_progBlinnPhong.setUnifVec3("u_CamPos", glm::vec3(40.28f, 321.5f, 2.5f));
-    m_progBlinnPhong.setUnifVec3("u_CamLook", glm::vec3(0.1f, -0.99f, -0.04f));
-
     m_texture.bind(0);
-    m_terrain.draw(m_player.mcr_position, &m_progLambert, &m_progBlinnPhong, m_player.mcr_camera);
+    m_terrain.draw(m_player.mcr_position, &m_progLambert, &m_progBlinnPhong, &m_progDepth, m_player.mcr_camera);
 
     glDisable(GL_DEPTH_TEST);
-    m_progFlat.setUnifMat4("u_Model", glm::mat4());
     m_progFlat.draw(m_worldAxes);
     glEnable(GL_DEPTH_TEST);
 
@@ -305,6 +305,28 @@ void MyGL::keyPressEvent(QKeyEvent *e) {
         inputBundle.fPressed = !inputBundle.fPressed;
     } else if (e->key() == Qt::Key_Space) {
         inputBundle.spacePressed = true;
+    } else if (e->key() == Qt::Key_F3) {
+        m_terrain.printStats(std::cout);
+    } else if (e->key() == Qt::Key_F4) {
+        m_terrain.setMultiDraw(!m_terrain.isMultiDraw());
+        std::cout << "Chunk submission: " << (m_terrain.isMultiDraw() ? "multi-draw" : "one draw per mesh") << std::endl;
+    } else if (e->key() == Qt::Key_F5) {
+        // Unsorted -> front to back -> front to back with a depth prepass
+        OpaqueOrder order = static_cast<OpaqueOrder>((static_cast<int>(m_terrain.getOpaqueOrder()) + 1) % 3);
+        m_terrain.setOpaqueOrder(order);
+        std::cout << "Opaque chunks: " << opaqueOrderName(order) << std::endl;
+    } else if (e->key() == Qt::Key_F6) {
+        m_terrain.setMeasureOverdraw(!m_terrain.isMeasuringOverdraw());
+        std::cout << "Overdraw measurement: " << (m_terrain.isMeasuringOverdraw() ? "on (see F3)" : "off") << std::endl;
+    } else if (e->key() == Qt::Key_BracketLeft || e->key() == Qt::Key_BracketRight) {
+        // One zone (4 chunks) less or more around the player
+        int step = e->key() == Qt::Key_BracketLeft ? -1 : 1;
+        m_terrain.setGenerationDistance(m_terrain.getGenerationDistance() + step);
+        std::cout << "Generation distance: " << m_terrain.getGenerationDistance() << " zones" << std::endl;
+    } else if (e->key() == Qt::Key_Minus || e->key() == Qt::Key_Equal) {
+        float step = e->key() == Qt::Key_Minus ? -32.f : 32.f;
+        m_terrain.setViewDistance(m_terrain.getViewDistance() + step);
+        std::cout << "View distance: " << m_terrain.getViewDistance() << " blocks" << std::endl;
     }
 }
 
@@ -389,6 +411,10 @@ void MyGL::setFolderLocation(std::string folderLocation) {
 void MyGL::triggerSave() {
     m_terrain.saveTerrain();
 }
+
+void MyGL::waitForWorkers() {
+    m_terrain.waitForWorkers();
+}
 void MyGL::playStepSounds() {
     switch (m_player.onTopOf) {
     case GRASS:
@@ -443,11 +469,11 @@ void MyGL::renderPostProcess() {
     glClearColor(0.37f, 0.74f, 1.0f, 1); // sky color
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-    printGLErrorLog();
+    checkGLErrors();
     // Place the texture that stores the image of the 3D render
     // into texture slot 0
     m_postProcessFrameBuffer.bindToTextureSlot(0);
-    printGLErrorLog();
+    checkGLErrors();
 
     // Set the sampler2D in the post-process shader to
     // read from the texture slot that we set the
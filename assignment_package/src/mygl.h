@@ -10,6 +10,7 @@
 #include "scene/player.h"
 
 #include "framebuffer.h"
+#include "frameuniforms.h"
 
 #include <QOpenGLVertexArrayObject>
 #include <QOpenGLShaderProgram>
@@ -29,6 +30,7 @@ private:
     ShaderProgram m_progFlat;// A shader program that uses "flat" reflection (no shadowing at all)
     ShaderProgram m_progInstanced;// A shader program that is designed to be compatible with instanced rendering
     ShaderProgram m_progBlinnPhong;// A shader program that uses lambertian reflection
+    ShaderProgram m_progDepth;// A shader program that only writes depth, for the terrain's depth prepass
 
     ShaderProgram m_progPostProcessNoOp;
     ShaderProgram m_progPostProcessUnderWater;
@@ -39,6 +41,8 @@ private:
     Quad m_quadDrawable;
 
     FrameBuffer m_postProcessFrameBuffer;
+    // The camera and the time, shared by all shader programs
+    FrameUniforms m_frameUniforms;
 
 
     GLuint vao; // A handle for our vertex array object. This will store the VBOs created in our geometry classes.
@@ -95,6 +99,8 @@ public:
 
     void setFolderLocation(std::string folderLocation);
     void triggerSave();
+    // Block until the terrain's background jobs are done
+    void waitForWorkers();
 
     void playStepSounds();
     void stopStepSounds();
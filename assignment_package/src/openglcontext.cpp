@@ -8,7 +8,8 @@
 
 
 OpenGLContext::OpenGLContext(QWidget *parent)
-    : QOpenGLWidget(parent)
+    : QOpenGLWidget(parent), m_multiDrawElementsBaseVertex(nullptr),
+      m_drawElementsBaseVertex(nullptr), m_drawFunctionsResolved(false), m_defaultVertexArray(0)
 {}
 
 OpenGLContext::~OpenGLContext()
@@ -91,6 +92,16 @@ void OpenGLContext::printGLErrorLog()
     }
 }
 
+void OpenGLContext::setDefaultVertexArray(GLuint vao)
+{
+    m_defaultVertexArray = vao;
+}
+
+void OpenGLContext::bindDefaultVertexArray()
+{
+    glBindVertexArray(m_defaultVertexArray);
+}
+
 void OpenGLContext::printLinkInfoLog(int prog)
 {
     GLint linked;
@@ -142,3 +153,28 @@ void OpenGLContext::printShaderInfoLog(int shader)
     // Throwing here allows us to use the debugger to track down the error.
     throw;
 }
+
+void OpenGLContext::multiDrawElementsBaseVertex(GLenum mode, const GLsizei* counts, GLenum type,
+                                                const void* const* indices, GLsizei drawCount,
+                                                const GLint* baseVertices)
+{
+    if (!m_drawFunctionsResolved) {
+        QOpenGLContext *ctx = context();
+        m_multiDrawElementsBaseVertex = reinterpret_cast<MultiDrawElementsBaseVertexFn>(
+            ctx->getProcAddress("glMultiDrawElementsBaseVertex"));
+        m_drawElementsBaseVertex = reinterpret_cast<DrawElementsBaseVertexFn>(
+            ctx->getProcAddress("glDrawElementsBaseVertex"));
+        if (!m_multiDrawElementsBaseVertex) {
+            std::cerr << "glMultiDrawElementsBaseVertex is not available, "
+                         "drawing the chunks one by one" << std::endl;
+        }
+        m_drawFunctionsResolved = true;
+    }
+    if (m_multiDrawElementsBaseVertex) {
+        m_multiDrawElementsBaseVertex(mode, counts, type, indices, drawCount, baseVertices);
+    } else if (m_drawElementsBaseVertex) {
+        for (GLsizei i = 0; i < drawCount; ++i) {
+            m_drawElementsBaseVertex(mode, counts[i], type, indices[i], baseVertices[i]);
+        }
+    }
+}
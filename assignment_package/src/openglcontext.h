@@ -18,4 +18,33 @@ public:
     void printGLErrorLog();
     void printLinkInfoLog(int prog);
     void printShaderInfoLog(int shader);
+    // printGLErrorLog in debug builds. glGetError stalls the driver, so
+    // release builds don't check for errors after every draw.
+#ifdef QT_DEBUG
+    inline void checkGLErrors() { printGLErrorLog(); }
+#else
+    inline void checkGLErrors() {}
+#endif
+
+    // The vertex array object that is bound while nothing else is drawing.
+    // Objects with a vertex array of their own (like MeshArena) bind this
+    // one again when they are done.
+    void setDefaultVertexArray(GLuint vao);
+    void bindDefaultVertexArray();
+
+    // glMultiDrawElementsBaseVertex (OpenGL 3.2), which QOpenGLExtraFunctions
+    // doesn't expose, looked up through the context on first use.
+    // Without it, every range is drawn with its own glDrawElementsBaseVertex.
+    void multiDrawElementsBaseVertex(GLenum mode, const GLsizei* counts, GLenum type,
+                                     const void* const* indices, GLsizei drawCount,
+                                     const GLint* baseVertices);
+
+private:
+    typedef void (QOPENGLF_APIENTRYP MultiDrawElementsBaseVertexFn)(GLenum, const GLsizei*, GLenum,
+                                                                    const void* const*, GLsizei, const GLint*);
+    typedef void (QOPENGLF_APIENTRYP DrawElementsBaseVertexFn)(GLenum, GLsizei, GLenum, const void*, GLint);
+    MultiDrawElementsBaseVertexFn m_multiDrawElementsBaseVertex;
+    DrawElementsBaseVertexFn m_drawElementsBaseVertex;
+    bool m_drawFunctionsResolved;
+    GLuint m_defaultVertexArray;
 };
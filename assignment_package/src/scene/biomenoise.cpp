@@ -6,42 +6,57 @@
 #include <random>
 #include <ctime>
 
-float BiomeNoise::biomeTransitionThreshold = 0.01f;
+float BiomeNoise::biomeTransitionThreshold = 0.04f;
 unsigned int BiomeNoise::seed = 1;
 int BiomeNoise::biomeFloor = 145;
+std::vector<int> BiomeNoise::permutation = BiomeNoise::generatePermutation();
+
 void BiomeNoise::setSeed(unsigned int s) {
-    seed = s;
+    // Only rebuild the permutation table when the seed actually changes,
+    // every chunk calls this from its worker thread
+    if (s != seed) {
+        seed = s;
+        permutation = generatePermutation();
+    }
     srand(seed);
 }
 
-float BiomeNoise::pseudoRandom(int x, int z) {
-    unsigned int n = x * 123456789 + z * 987654321 + seed * 144630960;
-    n = (n ^ (n >> 13)) * 1274126177;
-    n = n ^ (n >> 16);
-    return (n % 1000) / 1000.0f;
+unsigned int BiomeNoise::getSeed() {
+    return seed;
 }
 
-// determines if within threshold transitioning between biomes
-bool BiomeNoise::isTransition(int x, int z) {
-    float value = fabs(perlin(x * 0.005f, z * 0.005f));
-    return value < biomeTransitionThreshold && value > -biomeTransitionThreshold;
+// Smoothly map the biome noise onto [0, 1] across the transition band
+float BiomeNoise::getMountainWeight(int gridX, int gridZ) {
+    float x = gridX * BIOME_GRID * 0.005f;
+    float z = gridZ * BIOME_GRID * 0.005f;
+    float noiseValue = perlin(x, z);
+
+    float t = (noiseValue + biomeTransitionThreshold) / (2.f * biomeTransitionThreshold);
+    t = std::clamp(t, 0.f, 1.f);
+    return t * t * (3.f - 2.f * t);
 }
 
-BiomeNoise::Biome BiomeNoise::getBiomeAt(int x, int z) {
-    float noiseValue = perlin(x * 0.005f, z * 0.005f);
+float BiomeNoise::getBlendedMountainWeight(int x, int z) {
+    // Floor division, so that negative coordinates land in the right cell
+    int gridX = static_cast<int>(std::floor(x / static_cast<float>(BIOME_GRID)));
+    int gridZ = static_cast<int>(std::floor(z / static_cast<float>(BIOME_GRID)));
+    float fx = (x - gridX * BIOME_GRID) / static_cast<float>(BIOME_GRID);
+    float fz = (z - gridZ * BIOME_GRID) / static_cast<float>(BIOME_GRID);
 
-    if (noiseValue > biomeTransitionThreshold) {
-        return MOUNTAIN;
-    } else if (noiseValue < -biomeTransitionThreshold) {
-        return GRASSLAND;
-    }
+    float w00 = getMountainWeight(gridX, gridZ);
+    float w10 = getMountainWeight(gridX + 1, gridZ);
+    float w01 = getMountainWeight(gridX, gridZ + 1);
+    float w11 = getMountainWeight(gridX + 1, gridZ + 1);
 
-    // in between
-    float value = pseudoRandom(x, z);
-    if (value > 0.5f) {
-        return MOUNTAIN;
-    }
-    return GRASSLAND;
+    return lerp(fz, lerp(fx, w00, w10), lerp(fx, w01, w11));
+}
+
+BiomeNoise::Biome BiomeNoise::getBiomeForWeight(float mountainWeight) {
+    return mountainWeight >= 0.5f ? MOUNTAIN : GRASSLAND;
+}
+
+BiomeNoise::Biome BiomeNoise::getBiomeAt(int x, int z) {
+    return getBiomeForWeight(getBlendedMountainWeight(x, z));
 }
 
 float BiomeNoise::getGrasslandHeight(int x, int z) {
@@ -52,17 +67,10 @@ float BiomeNoise::getMountainHeight(int x, int z) {
     return biomeFloor + 115.0f * fractal(x * 0.02f, z * 0.02f, 4, 0.5f);
 }
 
-int BiomeNoise::getHeightAt(int x, int z) {
-    float grasslandHeight = getGrasslandHeight(x, z);
-    float mountainHeight = getMountainHeight(x, z);
-    float height = grasslandHeight; // default grassland
-
-    Biome b = getBiomeAt(x, z);
-    if (isTransition(x, z)) {
-        float t = fabs(smooth(x * 0.005f, z * 0.005f));
-        height = lerp(t, grasslandHeight, mountainHeight);
-    } else if (b == MOUNTAIN) {
-        height = mountainHeight;
+int BiomeNoise::getHeightForWeight(int x, int z, float mountainWeight) {
+    float height = getGrasslandHeight(x, z);
+    if (mountainWeight > 0.f) {
+        height = lerp(mountainWeight, height, getMountainHeight(x, z));
     }
 
     if (height > 255) {
@@ -73,6 +81,10 @@ int BiomeNoise::getHeightAt(int x, int z) {
     return round(height);
 }
 
+int BiomeNoise::getHeightAt(int x, int z) {
+    return getHeightForWeight(x, z, getBlendedMountainWeight(x, z));
+}
+
 float BiomeNoise::fade(float t) {
     return t * t * t * (t * (t * 6 - 15) + 10);
 }
@@ -88,41 +100,18 @@ float BiomeNoise::grad(int hash, float x, float y) {
     return u + v;
 }
 
-float BiomeNoise::basic(int x, int y) {
-    int n = x + y * 57;
-    n = (n << 13) ^ n;
-    return 1.0f - ((n * (n * n * 15731 + 789221) + 1376312589) & 0x7fffffff) / 1073741824.0f;
-}
-
-float BiomeNoise::smooth(float x, float y) {
-    int intX = static_cast<int>(x);
-    int intY = static_cast<int>(y);
-
-    float fractionalX = x - intX;
-    float fractionalY = y - intY;
-
-    float v1 = basic(intX, intY);
-    float v2 = basic(intX + 1, intY);
-    float v3 = basic(intX, intY + 1);
-    float v4 = basic(intX + 1, intY + 1);
-
-    float i1 = lerp(fractionalX, v1, v2);
-    float i2 = lerp(fractionalX, v3, v4);
-
-    return lerp(fractionalY, i1, i2);
-}
-
-
 std::vector<int> BiomeNoise::generatePermutation() {
-    std::vector<int> permutation(256);
+    std::vector<int> permutation(512);
     for (int i = 0; i < 256; ++i) {
         permutation[i] = i;
     }
 
     // use seed
     std::default_random_engine engine(seed);
-    std::shuffle(permutation.begin(), permutation.end(), engine);
+    std::shuffle(permutation.begin(), permutation.begin() + 256, engine);
 
+    // Repeat the table so that lookups of p[X + 1] etc. don't need to wrap
+    std::copy(permutation.begin(), permutation.begin() + 256, permutation.begin() + 256);
     return permutation;
 }
 
@@ -136,10 +125,8 @@ float BiomeNoise::perlin(float x, float y) {
     float u = fade(x);
     float v = fade(y);
 
-    // get permutation from seed
-    std::vector<int> permutation = generatePermutation();
-    std::vector<int> p(permutation.begin(), permutation.end());
-    p.insert(p.end(), permutation.begin(), permutation.end());
+    // permutation of the current seed
+    const std::vector<int>& p = permutation;
 
     int A = p[X] + Y;
     int B = p[X + 1] + Y;
@@ -180,9 +167,7 @@ float BiomeNoise::perlin3D(float x, float y, float z) {
     float v = fade(y);
     float w = fade(z);
 
-    std::vector<int> permutation = generatePermutation();
-    std::vector<int> p(permutation.begin(), permutation.end());
-    p.insert(p.end(), permutation.begin(), permutation.end());
+    const std::vector<int>& p = permutation;
 
     int A = p[X] + Y, AA = p[A] + Z, AB = p[A + 1] + Z;
     int B = p[X + 1] + Y, BA = p[B] + Z, BB = p[B + 1] + Z;
@@ -12,25 +12,37 @@ public:
         MOUNTAIN
     };
 
+    // Biomes are classified on a coarse grid of BIOME_GRID x BIOME_GRID
+    // blocks and blended bilinearly in between (like Minecraft's biome layer)
+    static const int BIOME_GRID = 4;
+
     static void setSeed(unsigned int s);
+    static unsigned int getSeed();
     static Biome getBiomeAt(int x, int z);
     static int getHeightAt(int x, int z);
 
+    // How much of the mountain biome there is at a biome grid point,
+    // 0 is pure grassland and 1 is pure mountain.
+    // (gridX, gridZ) are in units of BIOME_GRID blocks
+    static float getMountainWeight(int gridX, int gridZ);
+    // Bilinearly interpolated mountain weight of the biome grid
+    // at a block position
+    static float getBlendedMountainWeight(int x, int z);
+    // Blend the grassland and mountain heights of a column with the given weight
+    static int getHeightForWeight(int x, int z, float mountainWeight);
+    static Biome getBiomeForWeight(float mountainWeight);
+
     static float perlin3D(float x, float y, float z);
 
 private:
     static int biomeFloor;
     static unsigned int seed;
+    // Permutation table of the current seed (repeated twice)
+    static std::vector<int> permutation;
     static float biomeTransitionThreshold;
 
-    static float pseudoRandom(int x, int z);
-
     static float getGrasslandHeight(int x, int z);
     static float getMountainHeight(int x, int z);
-    static bool isTransition(int x, int z);
-
-    static float basic(int x, int y);
-    static float smooth(float x, float y);
 
     static std::vector<int> generatePermutation();
     static float perlin(float x, float y);
@@ -1,16 +1,23 @@
 #include "blocktypeworker.h"
 
-BlockTypeWorker::BlockTypeWorker(Chunk* chunk)
-    : m_chunk(chunk)
+BlockTypeWorker::BlockTypeWorker(Chunk* chunk, StageMask stages)
+    : m_chunk(chunk), m_stages(stages)
 {}
 
+void BlockTypeWorker::setChunk(Chunk* chunk, StageMask stages) {
+    m_chunk = chunk;
+    m_stages = stages;
+}
+
 void BlockTypeWorker::run()
 {
-    // Generate the block data for the chunk
-    m_chunk->generate();
-    // Mark the chunk as having block data generated
-    m_chunk->setHasBlockData(true);
-    // Mark the chunk to update its VBO data
-    // (Should not be necessary, but it's better to be safe than sorry)
-    m_chunk->setNeedsUpdate(true);
+    if (m_chunk->hasBlockData()) {
+        // Carve in the stages that were skipped on the first pass
+        m_chunk->completeGeneration(m_stages);
+    } else {
+        // Generate the block data for the chunk
+        m_chunk->generate(m_stages);
+        // Mark the chunk as having block data generated
+        m_chunk->finishGeneration();
+    }
 }
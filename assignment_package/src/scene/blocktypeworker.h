@@ -8,11 +8,16 @@
 class BlockTypeWorker : public QRunnable
 {
 public:
-    BlockTypeWorker(Chunk* chunk);
+    // Generate the given stages of the chunk. If the chunk already
+    // has block data, only the stages it is still missing are run.
+    BlockTypeWorker(Chunk* chunk, StageMask stages = ALL_GENERATION_STAGES);
+    // Reuse the worker for another chunk
+    void setChunk(Chunk* chunk, StageMask stages);
     void run() override;
 
 private:
     Chunk* m_chunk;
+    StageMask m_stages;
 };
 
 #endif // BLOCKTYPEWORKER_H
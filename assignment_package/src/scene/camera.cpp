@@ -36,6 +36,10 @@ glm::mat4 Camera::getViewProj() const {
     return glm::perspective(glm::radians(m_fovy), m_aspect, m_near_clip, m_far_clip) * glm::lookAt(m_position, m_position + m_forward, m_up);
 }
 
+glm::vec3 Camera::getForward() const {
+    return m_forward;
+}
+
 std::array<glm::vec4, 6> Camera::getFrustumPlanes() const {
     glm::mat4 vp = getViewProj();
     std::array<glm::vec4, 6> planes;
@@ -24,4 +24,6 @@ public:
     glm::mat4 getViewProj() const;
     // Get the frustum planes
     std::array<glm::vec4, 6> getFrustumPlanes() const;
+    // Get the direction the camera looks in
+    glm::vec3 getForward() const;
 };
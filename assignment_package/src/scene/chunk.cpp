@@ -1,5 +1,6 @@
 #include "chunk.h"
 #include <iostream>
+#include <limits>
 
 // The size of a chunk in blocks
 // used as an external constant static
@@ -36,9 +37,23 @@ int wrap_value(int value, int min, int max) {
     return (value % range + range) % range + min;
 }
 
-Chunk::Chunk(OpenGLContext* context, int x, int z, const std::vector<Rivers>* rivers) : mp_riversList(rivers), Drawable(context), m_blocks(), minX(x), minZ(z), m_neighbors{{XPOS, nullptr}, {XNEG, nullptr}, {ZPOS, nullptr}, {ZNEG, nullptr}}, m_needsUpdate(true), m_levelOfDetail(2), m_hasBlockData(false), m_hasVBOData(false), m_hasGPUData(false)
+std::atomic<uint64_t> Chunk::s_discardedMeshes(0);
+std::atomic<uint64_t> Chunk::s_levelOfDetailRemeshes(0);
+std::atomic<uint64_t> Chunk::s_cachedMeshRestores(0);
+uint64_t Chunk::s_transparentSorts = 0;
+
+Chunk::Chunk(OpenGLContext* context, int x, int z, GenerationPipeline* pipeline, MeshArena* arena) : mp_pipeline(pipeline), m_generatedStages(0), m_modified(false), Drawable(context), m_blocks(), minX(x), minZ(z), m_levelOfDetail(2),
+      m_transparentCenter(0.f),
+      mp_arena(arena), m_gpuMesh{MeshArena::NO_MESH, MeshArena::NO_MESH, 0, 0, 0, 0, 0, chunkYLength, {}, glm::vec3(0.f), -1},
+      m_cachedMesh(m_gpuMesh), m_hasCachedMesh(false), m_cachedFrame(0),
+      m_state(ChunkState::Empty), m_version(1), m_contentVersion(1), m_meshVersion(0), m_uploadedVersion(0),
+      m_minHeight(0), m_maxHeight(chunkYLength), m_meshMinHeight(0), m_meshMaxHeight(0), m_meshByteSize(0),
+      m_meshLevelOfDetail(0), m_meshContentVersion(0), m_meshLevelOfDetailKey(0), m_lastDrawnFrame(0)
 {
     std::fill_n(m_blocks.begin(), chunkXLength*chunkYLength*chunkZLength, EMPTY);
+    for (std::atomic<Chunk*>& neighbor : m_neighbors) {
+        neighbor = nullptr;
+    }
 }
 
 Chunk::~Chunk() {
@@ -48,11 +63,8 @@ Chunk::~Chunk() {
     m_vertexDataTransparent.clear();
     m_indicesTransparent.clear();
     
-    // Clear neighbor map
-    m_neighbors.clear();
-    
-    // Clear VBO/VAO data through parent Drawable class
-    destroyVBOdata();
+    // Give the meshes' space in the arena back
+    destroyGPUData();
 }
 
 // Does bounds checking with at()
@@ -69,30 +81,49 @@ BlockType Chunk::getLocalBlockAt(int x, int y, int z) const {
 void Chunk::setLocalBlockAt(unsigned int x, unsigned int y, unsigned int z, BlockType t) {
     m_blockDataMutex.lock();
     m_blocks.at(x + chunkXLength * y + chunkZLength * chunkYLength * z) = t;
-    m_needsUpdate = true; // Update VBO data if the block changes
+    m_modified = true;
+    invalidateMesh(); // Update VBO data if the block changes
+    // Faces of the block and of the blocks around it can appear here,
+    // draw the chunk when this is in view even before it is meshed again
+    int height = static_cast<int>(y);
+    widenHeightRange(height, height + 1);
 
     if (x == 0 && m_neighbors[XNEG]) {
-        m_neighbors[XNEG]->m_needsUpdate = true;
+        m_neighbors[XNEG].load()->invalidateMesh();
+        m_neighbors[XNEG].load()->widenHeightRange(height, height + 1);
     }
     if (x == chunkXLength - 1 && m_neighbors[XPOS]) {
-        m_neighbors[XPOS]->m_needsUpdate = true;
+        m_neighbors[XPOS].load()->invalidateMesh();
+        m_neighbors[XPOS].load()->widenHeightRange(height, height + 1);
     }
     if (z == 0 && m_neighbors[ZNEG]) {
-        m_neighbors[ZNEG]->m_needsUpdate = true;
+        m_neighbors[ZNEG].load()->invalidateMesh();
+        m_neighbors[ZNEG].load()->widenHeightRange(height, height + 1);
     } 
     if (z == chunkZLength - 1 && m_neighbors[ZPOS]) {
-        m_neighbors[ZPOS]->m_needsUpdate = true;
+        m_neighbors[ZPOS].load()->invalidateMesh();
+        m_neighbors[ZPOS].load()->widenHeightRange(height, height + 1);
     }
     m_blockDataMutex.unlock();
 }
 
-void Chunk::linkNeighbor(uPtr<Chunk> &neighbor, Direction dir) {
+void Chunk::linkNeighbor(Chunk* neighbor, Direction dir) {
     if(neighbor != nullptr) {
-        this->m_neighbors[dir] = neighbor.get();
+        this->m_neighbors[dir] = neighbor;
         neighbor->m_neighbors[oppositeDirection.at(dir)] = this;
     }
 }
 
+void Chunk::unlinkNeighbors() {
+    for (Direction dir : {XPOS, XNEG, ZPOS, ZNEG}) {
+        Chunk* neighbor = m_neighbors[dir].exchange(nullptr);
+        if (neighbor) {
+            neighbor->m_neighbors[oppositeDirection.at(dir)] = nullptr;
+            neighbor->invalidateMesh();
+        }
+    }
+}
+
 // Map block type to color
 glm::vec4 Chunk::getBlockColor(BlockType block) {
     glm::vec4 color;
@@ -130,6 +161,11 @@ glm::vec4 Chunk::getBlockColor(BlockType block) {
 void Chunk::createVBOdata() {
     // Lock the block data to prevent concurrent modification
     m_blockDataMutex.lock();
+    // Every block change bumps the version while holding the lock,
+    // so this is exactly the version the mesh is built from
+    uint32_t version = m_version;
+    uint32_t contentVersion = m_contentVersion;
+    uint32_t levelOfDetailKey = getLevelOfDetailKey();
 
     // Setup vector for the buffer
     std::vector<Vertex> vertexDataOpaque;
@@ -139,7 +175,8 @@ void Chunk::createVBOdata() {
     std::vector<GLuint> indicesTransparent;
 
     // Determine the block size to draw based on the level of detail
-    int blockSize = std::pow(2, m_levelOfDetail);
+    int levelOfDetail = m_levelOfDetail;
+    int blockSize = std::pow(2, levelOfDetail);
     int blockSizeY = std::clamp(blockSize / 2, 1, chunkYLength);
     // Iterate over all block in the chunk in step sizes of blockSize
     for (unsigned int x = 0; x < chunkXLength; x += blockSize) {
@@ -155,54 +192,114 @@ void Chunk::createVBOdata() {
     
     m_blockDataMutex.unlock();
 
+    // The vertical extent of the mesh, for culling
+    float meshMinY = static_cast<float>(chunkYLength);
+    float meshMaxY = 0.f;
+    for (const std::vector<Vertex>* vertices : {&vertexDataOpaque, &vertexDataTransparent}) {
+        for (const Vertex& vertex : *vertices) {
+            meshMinY = std::min(meshMinY, vertex.position.y);
+            meshMaxY = std::max(meshMaxY, vertex.position.y);
+        }
+    }
+    if (meshMinY > meshMaxY) {
+        meshMinY = meshMaxY;
+    }
+
+    // The transparent faces are sorted by their centers for blending
+    std::vector<glm::vec3> transparentFaces;
+    transparentFaces.reserve(vertexDataTransparent.size() / 4);
+    glm::vec3 transparentMin(std::numeric_limits<float>::max());
+    glm::vec3 transparentMax(std::numeric_limits<float>::lowest());
+    for (size_t i = 0; i + 3 < vertexDataTransparent.size(); i += 4) {
+        glm::vec4 center = (vertexDataTransparent[i].position + vertexDataTransparent[i + 1].position
+                            + vertexDataTransparent[i + 2].position + vertexDataTransparent[i + 3].position) / 4.f;
+        transparentFaces.push_back(glm::vec3(center));
+        transparentMin = glm::min(transparentMin, glm::vec3(center));
+        transparentMax = glm::max(transparentMax, glm::vec3(center));
+    }
+
     // Lock the VBO data to prevent concurrent modification
     m_VBODataMutex.lock();
     // (I'm like 95% sure we don't need this because we have the atomic flag...)
+    m_meshMinHeight = static_cast<int>(std::floor(meshMinY));
+    m_meshMaxHeight = static_cast<int>(std::ceil(meshMaxY));
     m_vertexDataOpaque = std::move(vertexDataOpaque);
     m_indicesOpaque = std::move(indicesOpaque);
     m_vertexDataTransparent = std::move(vertexDataTransparent);
     m_indicesTransparent = std::move(indicesTransparent);
+    m_transparentFaces = std::move(transparentFaces);
+    m_transparentCenter = m_transparentFaces.empty() ? glm::vec3(0.f) : (transparentMin + transparentMax) / 2.f;
+    m_meshByteSize = (m_vertexDataOpaque.size() + m_vertexDataTransparent.size()) * sizeof(Vertex)
+                     + (m_indicesOpaque.size() + m_indicesTransparent.size()) * sizeof(GLuint);
+    m_meshLevelOfDetail = levelOfDetail;
+    m_meshContentVersion = contentVersion;
+    m_meshLevelOfDetailKey = levelOfDetailKey;
+    m_meshVersion = version;
     m_VBODataMutex.unlock();
 }
 
-void Chunk::bufferVertexData() {
+bool Chunk::bufferVertexData() {
     // If there is no VBO data to be buffered, skip
-    if (!m_hasVBOData) {
-        return;
+    if (m_state != ChunkState::MeshReady) {
+        return false;
     }
     // Lock the VBO data to prevent concurrent modification
-    // (I'm like 95% sure we don't need this because we have the atomic flag...)
     m_VBODataMutex.lock();
-    // Move interleaved data to GPU
-    generateBuffer(INTERLEAVED);
-    bindBuffer(INTERLEAVED);
-    mp_context->glBufferData(GL_ARRAY_BUFFER, m_vertexDataOpaque.size() * sizeof(Vertex), m_vertexDataOpaque.data(), GL_STATIC_DRAW);
-    // Move index data to GPU
-    generateBuffer(INDEX);
-    bindBuffer(INDEX);
-    mp_context->glBufferData(GL_ELEMENT_ARRAY_BUFFER, m_indicesOpaque.size() * sizeof(GLuint), m_indicesOpaque.data(), GL_STATIC_DRAW);
-    indexCounts[INDEX] = static_cast<int>(m_indicesOpaque.size());
-    // Move interleaved data to GPU
-    generateBuffer(INTERLEAVED_TRANSPARENT);
-    bindBuffer(INTERLEAVED_TRANSPARENT);
-    mp_context->glBufferData(GL_ARRAY_BUFFER, m_vertexDataTransparent.size() * sizeof(Vertex), m_vertexDataTransparent.data(), GL_STATIC_DRAW);
-    // Move index data to GPU
-    generateBuffer(INDEX_TRANSPARENT);
-    bindBuffer(INDEX_TRANSPARENT);
-    mp_context->glBufferData(GL_ELEMENT_ARRAY_BUFFER, m_indicesTransparent.size() * sizeof(GLuint), m_indicesTransparent.data(), GL_STATIC_DRAW);
-    indexCounts[INDEX_TRANSPARENT] = static_cast<int>(m_indicesTransparent.size());
+    // The blocks changed since the mesh was built, a newer one is on its way
+    if (m_meshVersion != m_version) {
+        m_VBODataMutex.unlock();
+        discardMesh(ChunkState::MeshReady);
+        return false;
+    }
+    // Replace the previous meshes in the arena. If only the levels of
+    // detail changed, keep them in the cache in case they change back.
+    bool hadMesh = hasGPUData();
+    if (hadMesh && m_gpuMesh.contentVersion == m_meshContentVersion
+        && m_gpuMesh.levelOfDetailKey != m_meshLevelOfDetailKey) {
+        s_levelOfDetailRemeshes++;
+        releaseCachedMesh();
+        std::swap(m_cachedMesh, m_gpuMesh);
+        m_hasCachedMesh = true;
+        m_cachedFrame = m_lastDrawnFrame;
+    } else {
+        releaseMesh(m_gpuMesh);
+        // The blocks changed, the cached meshes show the old ones
+        if (m_hasCachedMesh && m_cachedMesh.contentVersion != m_meshContentVersion) {
+            releaseCachedMesh();
+        }
+    }
+    m_gpuMesh.opaque = mp_arena->upload(m_vertexDataOpaque.data(), m_vertexDataOpaque.size(),
+                                        m_indicesOpaque.data(), m_indicesOpaque.size());
+    m_gpuMesh.transparent = mp_arena->upload(m_vertexDataTransparent.data(), m_vertexDataTransparent.size(),
+                                             m_indicesTransparent.data(), m_indicesTransparent.size());
 
     // Free up memory by clearing the VBO data in RAM
     m_vertexDataOpaque.clear();
     m_indicesOpaque.clear();
     m_vertexDataTransparent.clear();
     m_indicesTransparent.clear();
-    // And set the corresponding flag
-    m_hasVBOData = false;
-    m_hasGPUData = true;
+    m_gpuMesh.byteSize = m_meshByteSize;
+    m_gpuMesh.levelOfDetail = m_meshLevelOfDetail;
+    m_gpuMesh.contentVersion = m_meshContentVersion;
+    m_gpuMesh.levelOfDetailKey = m_meshLevelOfDetailKey;
+    m_gpuMesh.minHeight = m_meshMinHeight;
+    m_gpuMesh.maxHeight = m_meshMaxHeight;
+    // The transparent indices are in the order the faces were built in
+    m_gpuMesh.transparentFaces = std::move(m_transparentFaces);
+    m_gpuMesh.transparentCenter = m_transparentCenter;
+    m_gpuMesh.transparentOctant = -1;
+    m_transparentFaces.clear();
+    m_meshByteSize = 0;
+    // The chunk is culled with the extent of the mesh on the GPU now
+    m_minHeight = m_meshMinHeight;
+    m_maxHeight = m_meshMaxHeight;
+    // And move on to the next state (unless the chunk got regenerated in the meantime)
+    m_uploadedVersion = m_meshVersion.load();
+    ChunkState expected = ChunkState::MeshReady;
+    m_state.compare_exchange_strong(expected, ChunkState::Uploaded);
     // Unlock the VBO data again once we copied the data to the GPU
     m_VBODataMutex.unlock();
-
+    return true;
 }
 
 // Draw mode override, not really needed since 
@@ -419,40 +516,75 @@ void Chunk::addUV(std::vector<Vertex>& faceCorners, Direction direction, BlockTy
     }
 }
 
-bool Chunk::isOpaque(BlockType type) {
-    if (type == EMPTY || type == WATER || type == ICE) {
-        return false;
-    }
-    return true;
+size_t Chunk::getMeshByteSize() const {
+    return m_meshByteSize;
 }
 
-bool Chunk::isOpaqueOrLava(BlockType type) {
-    if (type == EMPTY || type == WATER || type == ICE || type == LAVA) {
+int Chunk::getTransparentOctant(const glm::vec3& cameraPosition) const {
+    glm::bvec3 positive = glm::greaterThan(cameraPosition, m_gpuMesh.transparentCenter);
+    return (positive.x ? 1 : 0) | (positive.y ? 2 : 0) | (positive.z ? 4 : 0);
+}
+
+bool Chunk::isTransparentOrderOutdated(const glm::vec3& cameraPosition) const {
+    return m_gpuMesh.transparent != MeshArena::NO_MESH
+           && getTransparentOctant(cameraPosition) != m_gpuMesh.transparentOctant;
+}
+
+bool Chunk::sortTransparentFaces(const glm::vec3& cameraPosition) {
+    if (!isTransparentOrderOutdated(cameraPosition)) {
         return false;
     }
+    const GPUMesh& mesh = m_gpuMesh;
+    int octant = getTransparentOctant(cameraPosition);
+    // Faces further along the octant's diagonal are closer to the camera,
+    // so drawing them by increasing projection on it draws back to front
+    glm::vec3 towardCamera(octant & 1 ? 1.f : -1.f, octant & 2 ? 1.f : -1.f, octant & 4 ? 1.f : -1.f);
+    std::vector<std::pair<float, GLuint>> faces;
+    faces.reserve(mesh.transparentFaces.size());
+    for (size_t i = 0; i < mesh.transparentFaces.size(); ++i) {
+        faces.emplace_back(glm::dot(mesh.transparentFaces[i], towardCamera), static_cast<GLuint>(i));
+    }
+    std::sort(faces.begin(), faces.end(),
+              [](const std::pair<float, GLuint>& a, const std::pair<float, GLuint>& b) { return a.first < b.first; });
+    // Same two triangles per face as generateBlockGeometry
+    std::vector<GLuint> indices;
+    indices.reserve(faces.size() * 6);
+    for (const std::pair<float, GLuint>& face : faces) {
+        GLuint base = face.second * 4;
+        indices.insert(indices.end(), {base, base + 1, base + 2, base, base + 2, base + 3});
+    }
+    mp_arena->updateIndices(mesh.transparent, indices.data());
+    m_gpuMesh.transparentOctant = octant;
+    s_transparentSorts++;
     return true;
 }
 
-bool Chunk::isAnimated(BlockType type) {
-    if (type == LAVA || type == WATER) {
-        return true;
-    }
-    return false;
+uint64_t Chunk::getTransparentSortCount() {
+    return s_transparentSorts;
 }
 
-// Draw the chunk
-void Chunk::draw(ShaderProgram* shaderProgram) {
-    if (!m_hasBlockData || !m_hasGPUData) {
-        return;
-    }
-    shaderProgram->drawInterleaved(*this);
+size_t Chunk::getGPUByteSize() const {
+    return m_gpuMesh.byteSize;
 }
 
-void Chunk::drawTransparent(ShaderProgram* shaderProgram) {
-    if (!m_hasBlockData || !m_hasGPUData) {
-        return;
-    }
-    shaderProgram->drawInterleavedTransparent(*this);
+int Chunk::getGPULevelOfDetail() const {
+    return m_gpuMesh.levelOfDetail;
+}
+
+size_t Chunk::getCachedByteSize() const {
+    return m_hasCachedMesh ? m_cachedMesh.byteSize : 0;
+}
+
+uint64_t Chunk::getCachedFrame() const {
+    return m_cachedFrame;
+}
+
+uint64_t Chunk::getLastDrawnFrame() const {
+    return m_lastDrawnFrame;
+}
+
+void Chunk::setLastDrawnFrame(uint64_t frame) {
+    m_lastDrawnFrame = frame;
 }
 
 // Get the level of detail of this chunk
@@ -467,11 +599,11 @@ void Chunk::setLevelOfDetail(int levelOfDetail) {
     if (levelOfDetail != m_levelOfDetail) {
         // Overwrite old VBO data
         m_levelOfDetail = levelOfDetail;
-        m_needsUpdate = true;
+        invalidateMesh(false);
         // Update the neighbors' LODs if they exist
-        for (const auto& [direction, chunk] : m_neighbors) {
+        for (Chunk* chunk : m_neighbors) {
             if (chunk) {
-                chunk->m_needsUpdate = true;
+                chunk->invalidateMesh(false);
             }
         }
     }
@@ -671,15 +803,57 @@ glm::vec4 Chunk::getNormal(Direction dir) {
     }
 }
 
+bool Chunk::isOpaque(BlockType type) {
+    if (type == EMPTY || type == WATER || type == ICE) {
+        return false;
+    }
+    return true;
+}
+
+bool Chunk::isOpaqueOrLava(BlockType type) {
+    if (type == EMPTY || type == WATER || type == ICE || type == LAVA) {
+        return false;
+    }
+    return true;
+}
+
+bool Chunk::isAnimated(BlockType type) {
+    if (type == LAVA || type == WATER) {
+        return true;
+    }
+    return false;
+}
+
 glm::vec2 Chunk::getCenter() const {
     return glm::vec2(minX + chunkXLength / 2, minZ + chunkZLength / 2);
 }
 
-bool Chunk::isInView(const Camera& camera) const {
-    std::array<glm::vec4, 6> frustumPlanes = camera.getFrustumPlanes();
+glm::ivec2 Chunk::getCorner() const {
+    return glm::ivec2(minX, minZ);
+}
+
+bool Chunk::isModified() const {
+    return m_modified;
+}
+
+Chunk* Chunk::getNeighbor(Direction dir) const {
+    return m_neighbors[dir];
+}
+
+glm::ivec2 Chunk::getHeightRange() const {
+    return glm::ivec2(m_minHeight, m_maxHeight);
+}
+
+void Chunk::widenHeightRange(int minY, int maxY) {
+    int current = m_minHeight;
+    while (minY < current && !m_minHeight.compare_exchange_weak(current, minY)) {}
+    current = m_maxHeight;
+    while (maxY > current && !m_maxHeight.compare_exchange_weak(current, maxY)) {}
+}
 
-    glm::vec3 minPoint(minX, 0.f, minZ);
-    glm::vec3 maxPoint(minX + chunkXLength, chunkYLength, minZ + chunkZLength);
+bool Chunk::isInView(const std::array<glm::vec4, 6>& frustumPlanes) const {
+    glm::vec3 minPoint(minX, m_minHeight, minZ);
+    glm::vec3 maxPoint(minX + chunkXLength, m_maxHeight, minZ + chunkZLength);
 
     for (const auto& plane : frustumPlanes) {
         glm::vec3 positiveVertex = minPoint;
@@ -694,117 +868,216 @@ bool Chunk::isInView(const Camera& camera) const {
     return true;
 }
 
-void Chunk::setHasBlockData(bool val) {
-    m_hasBlockData = val;
+ChunkState Chunk::getState() const {
+    return m_state;
 }
-bool Chunk::hasBlockData() const {
-    return m_hasBlockData;
+uint32_t Chunk::getVersion() const {
+    return m_version;
 }
 
-void Chunk::setHasVBOData(bool val) {
-    m_hasVBOData = val;
+bool Chunk::hasBlockData() const {
+    return m_state >= ChunkState::Generated;
 }
+
 bool Chunk::hasVBOData() const {
-    return m_hasVBOData;
+    return m_state == ChunkState::MeshReady;
 }
 
-void Chunk::setNeedsUpdate(bool val) {
-    m_needsUpdate = val;
-}
 bool Chunk::needsUpdate() const {
-    return m_needsUpdate;
+    switch (m_state.load()) {
+    case ChunkState::Generated:
+        return true;
+    case ChunkState::MeshReady:
+    case ChunkState::Uploaded:
+        return m_meshVersion != m_version;
+    default:
+        // While meshing, the outdated mesh is discarded when it is done,
+        // which brings the chunk back to Generated
+        return false;
+    }
 }
 
-void Chunk::setHasGPUData(bool val) {
-    m_hasGPUData = val;
-}
 bool Chunk::hasGPUData() const {
-    return m_hasGPUData;
+    return m_uploadedVersion != 0;
 }
 
-void Chunk::generate() {
-    // Set seed for noise generation
-    BiomeNoise::setSeed(1);
+MeshArena::Handle Chunk::getOpaqueMesh() const {
+    return m_gpuMesh.opaque;
+}
 
-    int oceanHeight = 140;
-    for (int x = minX; x < minX + 16; ++x) {
-        for (int z = minZ; z < minZ + 16; ++z) {
-            int height = BiomeNoise::getHeightAt(x, z);
-            BiomeNoise::Biome biome = BiomeNoise::getBiomeAt(x, z);
-            for (int y = 0; y < 256; ++y) {
-                setLocalBlockAt(x - minX, y, z - minZ, getGeneratedBlockAt(x, y, z, height, biome));
-            }
-        }
-    }
+MeshArena::Handle Chunk::getTransparentMesh() const {
+    return m_gpuMesh.transparent;
 }
 
-BlockType Chunk::getGeneratedBlockAt(int x, int y, int z, int height, BiomeNoise::Biome biome) const {
-    if (y > 255 || y < 0) {
-        return EMPTY;
+void Chunk::invalidateMesh(bool contentChanged) {
+    // The content version goes first, so that whoever reads the version
+    // and then the content version can't miss a block change
+    if (contentChanged) {
+        m_contentVersion++;
     }
+    m_version++;
+}
 
-    if (y == 0) {
-        return BEDROCK;
+uint32_t Chunk::getLevelOfDetailKey() const {
+    // 4 bits per level of detail, 15 for a missing neighbor
+    uint32_t key = static_cast<uint32_t>(m_levelOfDetail) & 15;
+    for (Direction dir : {XPOS, XNEG, ZPOS, ZNEG}) {
+        const Chunk* neighbor = m_neighbors[dir];
+        key = key << 4 | (neighbor ? static_cast<uint32_t>(neighbor->m_levelOfDetail) & 15 : 15);
     }
+    return key;
+}
 
-    int caveMaxHeight = 80;
-    int caveMinHeight = 40; // increase to reduce load time
+void Chunk::discardMesh(ChunkState from) {
+    if (m_state.compare_exchange_strong(from, ChunkState::Generated)) {
+        s_discardedMeshes++;
+    }
+}
 
-    // Caves
-    if (y >= caveMinHeight && y < caveMaxHeight) {
-        float noise = BiomeNoise::perlin3D(x * 0.1f, y * 0.1f, z * 0.1f);
-        if (noise < 0.0f) {
-            return y < caveMinHeight + 5 ? LAVA : EMPTY;
+void Chunk::finishGeneration() {
+    ChunkState expected = ChunkState::Generating;
+    m_state.compare_exchange_strong(expected, ChunkState::Generated);
+    invalidateMesh();
+    // The faces along our borders depend on these blocks
+    for (Chunk* chunk : m_neighbors) {
+        if (chunk) {
+            chunk->invalidateMesh();
         }
     }
+}
 
-    // River logic
-    int oceanHeight = 140;
-    int riverDepth = 4;
-
-    if (mp_riversList && height > oceanHeight) {
-        for (const Rivers& r : *mp_riversList) {
-            if (r.isRiverAt(x, z)) {
-                // Determine river block types
-                if (y >= height) {
-                    return EMPTY; // Air above the river
-                } else if (y > oceanHeight - riverDepth) {
-                    return WATER; // River water
-                } else if (y == oceanHeight - riverDepth - 1) {
-                    return DIRT; // Riverbed dirt
-                }
-            }
+bool Chunk::beginMeshing() {
+    ChunkState state = m_state;
+    while (state == ChunkState::Generated || state == ChunkState::MeshReady || state == ChunkState::Uploaded) {
+        if (m_state.compare_exchange_weak(state, ChunkState::Meshing)) {
+            return true;
         }
     }
+    return false;
+}
 
-    if (y > height) {
-        // Water
-        if (height < 138 && y <= 138 && y >= fmax(height + 1, caveMaxHeight + 1)) {
-            return WATER;
-        } else {
-            return EMPTY;
-        }
-    } else if (y == height) {
-        if (biome == BiomeNoise::GRASSLAND) {
-            return GRASS;
-        } else if (biome == BiomeNoise::MOUNTAIN) {
-            if (height > 200) {
-                return SNOW;
-            } else {
-                return STONE;
-            }
-        } else {
-            return STONE;
-        }
-    } else if (y > 0 && y < height) {
-        if (biome == BiomeNoise::GRASSLAND) {
-            return DIRT;
-        } else {
-            return STONE;
-        }
+void Chunk::finishMeshing() {
+    if (m_meshVersion != m_version) {
+        discardMesh(ChunkState::Meshing);
+        return;
     }
+    ChunkState expected = ChunkState::Meshing;
+    m_state.compare_exchange_strong(expected, ChunkState::MeshReady);
+}
+
+void Chunk::abortMeshing() {
+    ChunkState expected = ChunkState::Meshing;
+    m_state.compare_exchange_strong(expected, ChunkState::Generated);
+}
+
+void Chunk::destroyGPUData() {
+    releaseMesh(m_gpuMesh);
+    releaseCachedMesh();
+    m_uploadedVersion = 0;
+    m_minHeight = 0;
+    m_maxHeight = chunkYLength;
+    ChunkState expected = ChunkState::Uploaded;
+    m_state.compare_exchange_strong(expected, ChunkState::Generated);
+}
 
-    return EMPTY;
+void Chunk::releaseMesh(GPUMesh& mesh) {
+    mp_arena->release(mesh.opaque);
+    mp_arena->release(mesh.transparent);
+    mesh.opaque = MeshArena::NO_MESH;
+    mesh.transparent = MeshArena::NO_MESH;
+    mesh.byteSize = 0;
+    mesh.transparentFaces.clear();
+    mesh.transparentFaces.shrink_to_fit();
+    mesh.transparentOctant = -1;
+}
+
+bool Chunk::restoreCachedMesh() {
+    if (!m_hasCachedMesh) {
+        return false;
+    }
+    // Read the version first, a change after that makes the chunk outdated again
+    uint32_t version = m_version;
+    ChunkState state = m_state;
+    if ((state != ChunkState::Generated && state != ChunkState::Uploaded)
+        || m_cachedMesh.contentVersion != m_contentVersion
+        || m_cachedMesh.levelOfDetailKey != getLevelOfDetailKey()) {
+        return false;
+    }
+    // Fails if a worker started meshing the chunk in the meantime
+    if (!m_state.compare_exchange_strong(state, ChunkState::Uploaded)) {
+        return false;
+    }
+    m_VBODataMutex.lock();
+    // The meshes drawn so far become the cached ones, so that
+    // switching back and forth again is free as well
+    std::swap(m_gpuMesh, m_cachedMesh);
+    m_hasCachedMesh = hasGPUData();
+    m_cachedFrame = m_lastDrawnFrame;
+    m_minHeight = m_gpuMesh.minHeight;
+    m_maxHeight = m_gpuMesh.maxHeight;
+    m_meshVersion = version;
+    m_uploadedVersion = version;
+    m_VBODataMutex.unlock();
+    s_cachedMeshRestores++;
+    return true;
+}
+
+void Chunk::releaseCachedMesh() {
+    if (m_hasCachedMesh) {
+        releaseMesh(m_cachedMesh);
+        m_hasCachedMesh = false;
+    }
+}
+
+uint64_t Chunk::getDiscardedMeshCount() {
+    return s_discardedMeshes;
+}
+
+uint64_t Chunk::getLevelOfDetailRemeshCount() {
+    return s_levelOfDetailRemeshes;
+}
+
+uint64_t Chunk::getCachedMeshRestoreCount() {
+    return s_cachedMeshRestores;
+}
+
+StageMask Chunk::getGeneratedStages() const {
+    return m_generatedStages;
+}
+
+void Chunk::generate(StageMask stages) {
+    // Set seed for noise generation
+    BiomeNoise::setSeed(1);
+
+    // Fill the whole chunk in one go instead of block by block,
+    // so we only have to take the lock once
+    m_blockDataMutex.lock();
+    // Any mesh that is still being built from the old blocks is dropped
+    m_state = ChunkState::Generating;
+    invalidateMesh();
+    mp_pipeline->generate(m_blocks.data(), minX, minZ, stages);
+    m_generatedStages = stages;
+    m_blockDataMutex.unlock();
+}
+
+void Chunk::completeGeneration(StageMask stages) {
+    StageMask missing = stages & ~m_generatedStages;
+    if (missing == 0) {
+        return;
+    }
+    BiomeNoise::setSeed(1);
+
+    m_blockDataMutex.lock();
+    mp_pipeline->generate(m_blocks.data(), minX, minZ, missing, false);
+    m_generatedStages = m_generatedStages | missing;
+    invalidateMesh();
+    m_blockDataMutex.unlock();
+
+    for (Chunk* chunk : m_neighbors) {
+        if (chunk) {
+            chunk->invalidateMesh();
+        }
+    }
 }
 
 void Chunk::serializeModifiedBlocks(std::ofstream& ofs) {
@@ -814,17 +1087,17 @@ void Chunk::serializeModifiedBlocks(std::ofstream& ofs) {
 
     std::unordered_map<unsigned int, BlockType> modifiedBlocks;
 
+    // Regenerate the chunk with the same stages it was originally generated with
+    std::vector<BlockType> generatedBlocks(chunkXLength * chunkYLength * chunkZLength);
+    mp_pipeline->generate(generatedBlocks.data(), minX, minZ, m_generatedStages);
+
     for (unsigned int x = 0; x < chunkXLength; ++x) {
         for (unsigned int z = 0; z < chunkZLength; ++z) {
-            int worldX = minX + x;
-            int worldZ = minZ + z;
-            int height = BiomeNoise::getHeightAt(worldX, worldZ);
-            BiomeNoise::Biome biome = BiomeNoise::getBiomeAt(worldX, worldZ);
             for (unsigned int y = 0; y < chunkYLength; ++y) {
-                BlockType generatedBlock = getGeneratedBlockAt(worldX, y, worldZ, height, biome);
-                BlockType actualBlock = getLocalBlockAt(x, y, z);
+                unsigned int index = x + chunkXLength * y + chunkZLength * chunkYLength * z;
+                BlockType generatedBlock = generatedBlocks[index];
+                BlockType actualBlock = m_blocks[index];
                 if (generatedBlock != actualBlock) {
-                    unsigned int index = x + chunkXLength * y + chunkZLength * chunkYLength * z;
                     modifiedBlocks[index] = actualBlock;
                 }
             }
@@ -857,6 +1130,9 @@ void Chunk::deserializeModifiedBlocks(std::ifstream& ifs) {
     uint16_t numModifiedBlocks;
     ifs.read(reinterpret_cast<char*>(&numModifiedBlocks), sizeof(numModifiedBlocks));
 
+    // The loaded blocks are already in the zone file, setLocalBlockAt
+    // shouldn't make the zone count as modified and get written again
+    bool wasModified = m_modified;
     for (uint16_t i = 0; i < numModifiedBlocks; ++i) {
         int xz_int = ifs.get();
         int y_int = ifs.get();
@@ -865,7 +1141,7 @@ void Chunk::deserializeModifiedBlocks(std::ifstream& ifs) {
         // Check for EOF
         if (xz_int == EOF || y_int == EOF || blockType_int == EOF) {
             std::cerr << "Unexpected end of file while reading modified blocks." << std::endl;
-            return;
+            break;
         }
 
         uint8_t xz = static_cast<uint8_t>(xz_int);
@@ -876,4 +1152,5 @@ void Chunk::deserializeModifiedBlocks(std::ifstream& ifs) {
         unsigned int z = xz & 0x0F;
         setLocalBlockAt(x, y, z, static_cast<BlockType>(blockType));
     }
+    m_modified = wasModified;
 }
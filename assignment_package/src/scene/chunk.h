@@ -3,6 +3,7 @@
 #include "../glm_includes.h"
 #include <array>
 #include <algorithm>
+#include <atomic>
 #include <unordered_map>
 #include <cstddef>
 #include <fstream>
@@ -11,7 +12,8 @@
 #include "../shaderprogram.h"
 #include "camera.h"
 #include "biomenoise.h"
-#include "rivers.h"
+#include "generationpipeline.h"
+#include "mesharena.h"
 
 
 //using namespace std; 
@@ -36,6 +38,19 @@ enum BlockType : unsigned char
 // (It will crash if you don't do this!)
 const int MAX_BLOCK_TYPES = 10;
 
+// The lifecycle of a Chunk's data, in the order a Chunk normally goes
+// through it. A Chunk whose blocks change while it is in one of the later
+// states stays there (keeping its old mesh on screen) until it is meshed again.
+enum class ChunkState : unsigned char
+{
+    Empty,      // Created, no block data yet
+    Generating, // Block data is being generated or loaded
+    Generated,  // Block data is ready, the mesh is missing or outdated
+    Meshing,    // A VBOWorker is building the mesh
+    MeshReady,  // The mesh is built and waiting to be buffered to the GPU
+    Uploaded    // The mesh on the GPU was built from the latest block data
+};
+
 // The six cardinal directions in 3D space
 enum Direction : unsigned char
 {
@@ -73,10 +88,11 @@ private:
     std::array<BlockType, 65536> m_blocks;
     // The coordinates of the chunk's lower-left corner in world space
     int minX, minZ;
-    // This Chunk's four neighbors to the north, south, east, and west
-    // The third input to this map just lets us use a Direction as
-    // a key for this map.
-    std::unordered_map<Direction, Chunk*, EnumHash> m_neighbors;    
+    // This Chunk's four neighbors to the north, south, east, and west,
+    // indexed by Direction (the YPOS and YNEG entries are always null).
+    // Chunks loaded from disk are linked on a worker thread while
+    // others read the links, so every entry is atomic.
+    std::array<std::atomic<Chunk*>, 6> m_neighbors;
     // Member variable that specifies the level of detail for this chunk
     // 0 is the highest level
     int m_levelOfDetail;
@@ -90,6 +106,37 @@ private:
     std::vector<Vertex> m_vertexDataTransparent;
     // Transparent Index data for this chunk
     std::vector<GLuint> m_indicesTransparent;
+    // The center of each transparent face (4 vertices and 6 indices each),
+    // and the center of all of them, to sort the faces for blending
+    std::vector<glm::vec3> m_transparentFaces;
+    glm::vec3 m_transparentCenter;
+
+    // ------ GPU data ------
+    // The arena shared by all chunks (owned by Terrain)
+    MeshArena* mp_arena;
+    // Meshes in the arena and what they were built from (render thread only)
+    struct GPUMesh {
+        MeshArena::Handle opaque, transparent;
+        size_t byteSize;
+        int levelOfDetail;
+        // The content version and the levels of detail key
+        // (see getLevelOfDetailKey) the meshes were built with
+        uint32_t contentVersion;
+        uint32_t levelOfDetailKey;
+        int minHeight, maxHeight;
+        // The transparent faces' centers, and the octant around their
+        // center the transparent indices are sorted for (-1 if unsorted)
+        std::vector<glm::vec3> transparentFaces;
+        glm::vec3 transparentCenter;
+        int transparentOctant;
+    };
+    // The meshes drawn for this chunk
+    GPUMesh m_gpuMesh;
+    // The meshes of the levels of detail before the last switch, kept
+    // for a while so that switching back doesn't need a new mesh
+    GPUMesh m_cachedMesh;
+    bool m_hasCachedMesh;
+    uint64_t m_cachedFrame;
 
     // ------ Mutexes ------
     // Mutex to protect the block data of this chunk
@@ -98,14 +145,55 @@ private:
     QMutex m_VBODataMutex;
 
     // ------ Atomics ------
-    // Variable to indicate whether or not this chunk has its block data generated
-    std::atomic<bool> m_hasBlockData;
-    // Variable to indicate whether or not this chunks VBO data needs to be updated
-    std::atomic<bool> m_needsUpdate;
-    // Variable to indicate whether or not the VBO data has been generated (and stored in CPU memory)
-    std::atomic<bool> m_hasVBOData;
-    // Variable to indicate whether or not the VBO data has been transferred to the GPU
-    std::atomic<bool> m_hasGPUData;
+    // Where this chunk is in its lifecycle
+    std::atomic<ChunkState> m_state;
+    // Incremented whenever something that affects the mesh changes
+    // (blocks, neighboring border blocks or the level of detail)
+    std::atomic<uint32_t> m_version;
+    // Incremented with m_version, except for level of detail changes
+    std::atomic<uint32_t> m_contentVersion;
+    // The version the latest mesh was built from
+    std::atomic<uint32_t> m_meshVersion;
+    // The version of the mesh on the GPU (0 if there is none)
+    std::atomic<uint32_t> m_uploadedVersion;
+    // Number of meshes thrown away because they were outdated when done
+    static std::atomic<uint64_t> s_discardedMeshes;
+    // Number of meshes uploaded only because a level of detail changed,
+    // and of meshes restored from the cache instead
+    static std::atomic<uint64_t> s_levelOfDetailRemeshes;
+    static std::atomic<uint64_t> s_cachedMeshRestores;
+    // Number of times the transparent faces were sorted (render thread only)
+    static uint64_t s_transparentSorts;
+    // The range of y the uploaded mesh spans, the whole chunk height if
+    // there is none. Block changes widen it until the next upload.
+    std::atomic<int> m_minHeight;
+    std::atomic<int> m_maxHeight;
+    // The range of y of the mesh in the VBO data vectors
+    int m_meshMinHeight;
+    int m_meshMaxHeight;
+    // Size in bytes of the mesh in the VBO data vectors
+    std::atomic<size_t> m_meshByteSize;
+    // What the mesh in the VBO data vectors was built with
+    int m_meshLevelOfDetail;
+    uint32_t m_meshContentVersion;
+    uint32_t m_meshLevelOfDetailKey;
+    // The last frame the chunk was drawn in (render thread only)
+    uint64_t m_lastDrawnFrame;
+    // Make sure the height range includes [minY, maxY]
+    void widenHeightRange(int minY, int maxY);
+
+    // Mark the current mesh as outdated. contentChanged is false if only
+    // the level of detail of the chunk or of a neighbor changed.
+    void invalidateMesh(bool contentChanged = true);
+    // The levels of detail of this chunk and its neighbors packed together,
+    // which with the block data determine the mesh
+    uint32_t getLevelOfDetailKey() const;
+    // Give the meshes back to the arena
+    void releaseMesh(GPUMesh& mesh);
+    // The octant around the transparent faces' center the camera is in
+    int getTransparentOctant(const glm::vec3& cameraPosition) const;
+    // Drop an outdated mesh and go back to Generated
+    void discardMesh(ChunkState from);
     
     // --- VBO helper functions ---
     // Determine the block type for a given area
@@ -129,15 +217,24 @@ private:
     bool isOpaqueOrLava(BlockType);
     bool isAnimated(BlockType);
 
-    const std::vector<Rivers>* mp_riversList;
+    // The world generator shared by all chunks (owned by Terrain)
+    GenerationPipeline* mp_pipeline;
+    // The generation stages that have been applied to the block data
+    std::atomic<StageMask> m_generatedStages;
+    // Whether a block was changed through setLocalBlockAt,
+    // i.e. whether the chunk differs from its zone file
+    std::atomic<bool> m_modified;
 
 public:
     // --- Constructor ---
     // Default constructor
-    Chunk(OpenGLContext* context, int x, int z, const std::vector<Rivers>* rivers);
-    // Generate the block data for this chunk
-    // (Yes this is not a constructor, but its crucial in "constructing" the chunk)
-    void generate();
+    Chunk(OpenGLContext* context, int x, int z, GenerationPipeline* pipeline, MeshArena* arena);
+    // Generate the block data for this chunk, running only the given stages
+    // (Yes this is not a constructor, but its crucial in "constructing" the chunk).
+    // Moves the chunk to Generating, call finishGeneration() when done.
+    void generate(StageMask stages = ALL_GENERATION_STAGES);
+    // Run the stages that were skipped when this chunk was generated
+    void completeGeneration(StageMask stages = ALL_GENERATION_STAGES);
     // Destructor
     ~Chunk();
 
@@ -145,51 +242,110 @@ public:
     // Get block type in local chunk coordinates
     BlockType getLocalBlockAt(unsigned int x, unsigned int y, unsigned int z) const;
     BlockType getLocalBlockAt(int x, int y, int z) const;
-    // Get the generated block type in local chunk coordinates
-    BlockType getGeneratedBlockAt(int x, int y, int z, int height, BiomeNoise::Biome biome) const;
     // Get the level of detail for this chunk
     int getLevelOfDetail() const;
+    // Get where this chunk is in its lifecycle
+    ChunkState getState() const;
+    // Get the current version of the chunk's mesh relevant data
+    uint32_t getVersion() const;
     // Get whether this chunk has block data generated yet (this prevents race conditions)
     bool hasBlockData() const;
+    // Get the generation stages that have been applied to this chunk
+    StageMask getGeneratedStages() const;
     // Check whether this chunk needs its VBO data updated
     bool needsUpdate() const;
     // Check whether this chunk has its VBO data generated
     bool hasVBOData() const;
-    // Check whether this chunk has its VBO data sent to the GPU
+    // Check whether this chunk has VBO data on the GPU (possibly outdated)
     bool hasGPUData() const;
+    // Size in bytes of the meshes on the GPU (0 if there are none)
+    size_t getGPUByteSize() const;
+    // The level of detail of the meshes on the GPU
+    int getGPULevelOfDetail() const;
+    // The last frame the chunk was drawn in, for evicting its GPU data
+    uint64_t getLastDrawnFrame() const;
+    // Size in bytes of the cached meshes of a previous level of detail
+    // (0 if there are none), and the frame they were cached in
+    size_t getCachedByteSize() const;
+    uint64_t getCachedFrame() const;
+    // Get the meshes on the GPU (MeshArena::NO_MESH if there is none)
+    MeshArena::Handle getOpaqueMesh() const;
+    MeshArena::Handle getTransparentMesh() const;
     // Get the center of this Chunks coordinates
     glm::vec2 getCenter() const;
-    // Check if this Chunk is in the view frustum of the camera
-    bool isInView(const Camera& camera) const;
+    // Get the world space coordinates of this Chunks lower-left corner
+    glm::ivec2 getCorner() const;
+    // Has a block been changed since the chunk was generated or loaded?
+    bool isModified() const;
+    // Get the neighboring Chunk in the given direction (nullptr if there is none)
+    Chunk* getNeighbor(Direction dir) const;
+    // Get the range of y the chunk's geometry spans, for culling
+    glm::ivec2 getHeightRange() const;
+    // Check if this Chunk is in the view frustum
+    // (planes as returned by Camera::getFrustumPlanes)
+    bool isInView(const std::array<glm::vec4, 6>& frustumPlanes) const;
 
     // --- Setters ---
     // Set block type in local chunk coordinates
     void setLocalBlockAt(unsigned int x, unsigned int y, unsigned int z, BlockType t);
     // Set the level of detail for this chunk, and update the VBO data (if necessary)
     void setLevelOfDetail(int levelOfDetail);
-    // Mark this this chunk as having block data generated
-    void setHasBlockData(bool val);
-    // Mark this chunk as needing its VBO data updated
-    void setNeedsUpdate(bool val);
-    // Mark this chunk as having its VBO data generated
-    void setHasVBOData(bool val);
-    // Mark this chunk as having its VBO data sent to the GPU
-    void setHasGPUData(bool val);
+    // Remember that the chunk was drawn in this frame
+    void setLastDrawnFrame(uint64_t frame);
+
+    // --- Lifecycle transitions ---
+    // Generating -> Generated, once the block data is complete
+    // (generate() moves the chunk to Generating)
+    void finishGeneration();
+    // Generated / MeshReady / Uploaded -> Meshing.
+    // Returns false if the chunk can't be meshed right now.
+    bool beginMeshing();
+    // Meshing -> MeshReady, or back to Generated (dropping the mesh)
+    // if the blocks changed while it was being built
+    void finishMeshing();
+    // Meshing -> Generated, if building the mesh failed
+    void abortMeshing();
+    // Free the GPU buffers, the chunk is meshed again when it is needed
+    void destroyGPUData();
+    // Generated / Uploaded -> Uploaded, by swapping the cached meshes back
+    // in if they match the current blocks and levels of detail.
+    // Returns false if a new mesh has to be built.
+    bool restoreCachedMesh();
+    // Free the cached meshes of a previous level of detail
+    void releaseCachedMesh();
+    // Number of outdated meshes that were dropped instead of buffered
+    static uint64_t getDiscardedMeshCount();
+    // Number of meshes uploaded only because a level of detail changed,
+    // and of level of detail switches served from the cache
+    static uint64_t getLevelOfDetailRemeshCount();
+    static uint64_t getCachedMeshRestoreCount();
 
     // --- Helpers ---
     // Helper function to create links between neighboring Chunks
-    void linkNeighbor(uPtr<Chunk>& neighbor, Direction dir);
+    void linkNeighbor(Chunk* neighbor, Direction dir);
+    // Remove the links between this Chunk and its neighbors before it is unloaded.
+    // The neighbors' meshes are updated, their borders are exposed now.
+    void unlinkNeighbors();
 
     // --- VBO functions ---
     // Override the mode that OpenGL should use to draw objects in the chunk
     GLenum drawMode() override;
     // Create the VBO data for this chunk
     virtual void createVBOdata() override;
-    // Send vertex / VBO data to the GPU
-    void bufferVertexData();
-    // Draw the Chunk
-    void draw(ShaderProgram* shaderProgram);
-    void drawTransparent(ShaderProgram* shaderProgram);
+    // Send vertex / VBO data to the GPU, into the mesh arena.
+    // Returns false if there was nothing to send or the mesh was outdated.
+    bool bufferVertexData();
+    // Size in bytes of the mesh waiting to be sent to the GPU
+    size_t getMeshByteSize() const;
+    // Order the transparent faces on the GPU back to front for a camera at
+    // this position. The order only depends on the octant around the faces'
+    // center the camera is in, so it is kept until the camera leaves it.
+    // Returns false if the current order could be kept.
+    bool sortTransparentFaces(const glm::vec3& cameraPosition);
+    // Whether sortTransparentFaces would change the order
+    bool isTransparentOrderOutdated(const glm::vec3& cameraPosition) const;
+    // Number of times the transparent faces of a chunk were sorted
+    static uint64_t getTransparentSortCount();
 
     // --- IO operations ---
     // Serialize the modified blocks in this chunk to a file
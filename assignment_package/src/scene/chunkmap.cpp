@@ -0,0 +1,80 @@
+#include "chunkmap.h"
+
+ChunkMap::ChunkMap()
+    : m_shards(), m_version(0), m_size(0)
+{}
+
+ChunkMap::Shard& ChunkMap::shardFor(int64_t key) {
+    return const_cast<Shard&>(static_cast<const ChunkMap*>(this)->shardFor(key));
+}
+
+const ChunkMap::Shard& ChunkMap::shardFor(int64_t key) const {
+    // Chunk corners are multiples of 16 in both halves of the key,
+    // so mix the bits first to spread neighboring chunks over the shards
+    uint64_t h = static_cast<uint64_t>(key) * 0x9E3779B97F4A7C15ull;
+    return m_shards[(h >> 32) % NUM_SHARDS];
+}
+
+Chunk* ChunkMap::find(int64_t key) const {
+    const Shard& shard = shardFor(key);
+    QReadLocker locker(&shard.lock);
+    auto it = shard.chunks.find(key);
+    return it == shard.chunks.end() ? nullptr : it->second.get();
+}
+
+bool ChunkMap::contains(int64_t key) const {
+    return find(key) != nullptr;
+}
+
+std::pair<Chunk*, bool> ChunkMap::insert(int64_t key, uPtr<Chunk> chunk) {
+    Shard& shard = shardFor(key);
+    QWriteLocker locker(&shard.lock);
+    auto result = shard.chunks.emplace(key, std::move(chunk));
+    if (result.second) {
+        m_size++;
+        m_version++;
+    }
+    return std::make_pair(result.first->second.get(), result.second);
+}
+
+uPtr<Chunk> ChunkMap::erase(int64_t key) {
+    Shard& shard = shardFor(key);
+    QWriteLocker locker(&shard.lock);
+    auto it = shard.chunks.find(key);
+    if (it == shard.chunks.end()) {
+        return nullptr;
+    }
+    uPtr<Chunk> chunk = std::move(it->second);
+    shard.chunks.erase(it);
+    m_size--;
+    m_version++;
+    return chunk;
+}
+
+uint64_t ChunkMap::snapshot(std::vector<Chunk*>& chunks) const {
+    // Writers only ever hold a single shard's lock,
+    // so taking all of them in order can't deadlock
+    for (const Shard& shard : m_shards) {
+        shard.lock.lockForRead();
+    }
+    uint64_t version = m_version;
+    chunks.clear();
+    chunks.reserve(m_size);
+    for (const Shard& shard : m_shards) {
+        for (const auto& entry : shard.chunks) {
+            chunks.push_back(entry.second.get());
+        }
+    }
+    for (const Shard& shard : m_shards) {
+        shard.lock.unlock();
+    }
+    return version;
+}
+
+uint64_t ChunkMap::getVersion() const {
+    return m_version;
+}
+
+size_t ChunkMap::size() const {
+    return m_size;
+}
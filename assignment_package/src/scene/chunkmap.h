@@ -0,0 +1,65 @@
+#ifndef CHUNKMAP_H
+#define CHUNKMAP_H
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <QReadWriteLock>
+#include "../smartpointerhelp.h"
+#include "chunk.h"
+
+// Owns every Chunk of the Terrain, keyed by toKey() of the chunk's
+// lower-left corner. Safe to use from several threads at once:
+// zones loaded from disk insert their chunks from a worker thread
+// while the render thread looks chunks up and draws them.
+//
+// The keys are spread over a fixed number of shards, each with its own
+// reader-writer lock, so lookups only wait for an insertion into the
+// same shard and never for each other.
+class ChunkMap {
+public:
+    ChunkMap();
+
+    // The chunk stored under the key, or nullptr
+    Chunk* find(int64_t key) const;
+    bool contains(int64_t key) const;
+
+    // Store the chunk under the key, unless there already is one.
+    // Returns the chunk stored under the key afterwards, and whether
+    // it is the given one (the given chunk is deleted if it isn't).
+    std::pair<Chunk*, bool> insert(int64_t key, uPtr<Chunk> chunk);
+    // Remove the chunk stored under the key and hand it to the caller
+    // (nullptr if there is none). The caller has to make sure that no
+    // other thread still uses the chunk before deleting it.
+    uPtr<Chunk> erase(int64_t key);
+
+    // Fill the vector with all chunks and return the version of the map
+    // they were taken at. Holds every shard's read lock while copying,
+    // so the result is a consistent state of the whole map.
+    uint64_t snapshot(std::vector<Chunk*>& chunks) const;
+    // Changes with every insertion and removal, so that a snapshot
+    // only needs to be retaken when the version differs from its own
+    uint64_t getVersion() const;
+
+    size_t size() const;
+
+private:
+    static const int NUM_SHARDS = 16;
+
+    struct Shard {
+        mutable QReadWriteLock lock;
+        std::unordered_map<int64_t, uPtr<Chunk>> chunks;
+    };
+
+    Shard& shardFor(int64_t key);
+    const Shard& shardFor(int64_t key) const;
+
+    std::array<Shard, NUM_SHARDS> m_shards;
+    std::atomic<uint64_t> m_version;
+    std::atomic<size_t> m_size;
+};
+
+#endif // CHUNKMAP_H
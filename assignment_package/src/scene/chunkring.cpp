@@ -0,0 +1,106 @@
+#include "chunkring.h"
+#include "chunk.h"
+#include <algorithm>
+
+// Chunks per zone along each axis
+const static int zoneChunks = 4;
+
+ChunkRing::ChunkRing(int maxZoneRadius)
+    : m_zoneRadius(maxZoneRadius), m_size(1), m_mask(0), m_cells(),
+    m_minX(0), m_minZ(0), m_width((2 * maxZoneRadius + 1) * zoneChunks), m_resized(false),
+    m_hits(0), m_misses(0)
+{
+    while (m_size < m_width) {
+        m_size <<= 1;
+    }
+    m_mask = m_size - 1;
+    m_cells = std::vector<std::atomic<Chunk*>>(m_size * m_size);
+    for (std::atomic<Chunk*>& c : m_cells) {
+        c = nullptr;
+    }
+    // Start out centered on the zone at the origin
+    m_minX = -m_zoneRadius * zoneChunks;
+    m_minZ = -m_zoneRadius * zoneChunks;
+}
+
+void ChunkRing::setZoneRadius(int zoneRadius) {
+    zoneRadius = std::min(zoneRadius, (m_size / zoneChunks - 1) / 2);
+    if (zoneRadius != m_zoneRadius) {
+        m_zoneRadius = zoneRadius;
+        m_resized = true;
+    }
+}
+
+std::atomic<Chunk*>& ChunkRing::cell(int chunkX, int chunkZ) {
+    return m_cells[(chunkZ & m_mask) * m_size + (chunkX & m_mask)];
+}
+
+const std::atomic<Chunk*>& ChunkRing::cell(int chunkX, int chunkZ) const {
+    return m_cells[(chunkZ & m_mask) * m_size + (chunkX & m_mask)];
+}
+
+bool ChunkRing::inWindow(int chunkX, int chunkZ) const {
+    int minX = m_minX, minZ = m_minZ, width = m_width;
+    return chunkX >= minX && chunkX < minX + width
+           && chunkZ >= minZ && chunkZ < minZ + width;
+}
+
+Chunk* ChunkRing::find(int chunkX, int chunkZ) const {
+    Chunk* chunk = cell(chunkX, chunkZ).load(std::memory_order_acquire);
+    if (chunk && chunk->getCorner() == glm::ivec2(chunkX << 4, chunkZ << 4)) {
+        m_hits.fetch_add(1, std::memory_order_relaxed);
+        return chunk;
+    }
+    m_misses.fetch_add(1, std::memory_order_relaxed);
+    return nullptr;
+}
+
+void ChunkRing::set(int chunkX, int chunkZ, Chunk* chunk) {
+    if (inWindow(chunkX, chunkZ)) {
+        cell(chunkX, chunkZ).store(chunk, std::memory_order_release);
+    }
+}
+
+void ChunkRing::remove(int chunkX, int chunkZ) {
+    std::atomic<Chunk*>& c = cell(chunkX, chunkZ);
+    Chunk* chunk = c.load(std::memory_order_acquire);
+    if (chunk && chunk->getCorner() == glm::ivec2(chunkX << 4, chunkZ << 4)) {
+        c.compare_exchange_strong(chunk, nullptr);
+    }
+}
+
+void ChunkRing::recenter(int zoneX, int zoneZ, const LookupFn& lookup) {
+    int minX = (zoneX - m_zoneRadius) * zoneChunks;
+    int minZ = (zoneZ - m_zoneRadius) * zoneChunks;
+    if (minX == m_minX && minZ == m_minZ && !m_resized) {
+        return;
+    }
+    int width = (2 * m_zoneRadius + 1) * zoneChunks;
+    m_minX = minX;
+    m_minZ = minZ;
+    m_width = width;
+    m_resized = false;
+    for (int z = minZ; z < minZ + width; ++z) {
+        for (int x = minX; x < minX + width; ++x) {
+            std::atomic<Chunk*>& c = cell(x, z);
+            Chunk* chunk = c.load(std::memory_order_acquire);
+            // Cells of chunks that stayed inside the window keep their chunk
+            if (!chunk || chunk->getCorner() != glm::ivec2(x << 4, z << 4)) {
+                c.store(lookup(x, z), std::memory_order_release);
+            }
+        }
+    }
+}
+
+uint64_t ChunkRing::getHits() const {
+    return m_hits;
+}
+
+uint64_t ChunkRing::getMisses() const {
+    return m_misses;
+}
+
+void ChunkRing::resetCounters() {
+    m_hits = 0;
+    m_misses = 0;
+}
@@ -0,0 +1,73 @@
+#ifndef CHUNKRING_H
+#define CHUNKRING_H
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+class Chunk;
+
+// A dense, toroidal 2D grid of Chunk pointers covering the square of
+// zones around the player, used as a fast path in front of the
+// Terrain's ChunkMap. Chunk (x, z) is stored in cell
+// (x mod size, z mod size), so looking a chunk up is a mask and an
+// array index, and moving the window only rewrites the cells that
+// now belong to different chunks.
+//
+// Coordinates are chunk coordinates, i.e. world coordinates >> 4.
+//
+// The ring is a cache, not an index: find() returns nullptr if the
+// chunk isn't in the ring (outside of the window, or inserted into
+// the map by another thread while the window moved), and the caller
+// falls back to the map. Every cell is checked against the chunk's
+// own corner, so a stale cell is a miss and never a wrong chunk.
+class ChunkRing {
+public:
+    typedef std::function<Chunk*(int chunkX, int chunkZ)> LookupFn;
+
+    // The window spans up to maxZoneRadius zones around the center zone
+    ChunkRing(int maxZoneRadius);
+
+    // Change the number of zones the window spans around the center zone
+    // (at most the maximum radius), takes effect on the next recenter()
+    void setZoneRadius(int zoneRadius);
+
+    Chunk* find(int chunkX, int chunkZ) const;
+    // Store the chunk, if it lies inside the window
+    void set(int chunkX, int chunkZ, Chunk* chunk);
+    // Clear the chunk's cell. Has to be called before the chunk is deleted.
+    void remove(int chunkX, int chunkZ);
+
+    // Move the window to be centered on the given zone and fill the
+    // cells that changed with the chunks returned by the lookup.
+    // Only called from the render thread.
+    void recenter(int zoneX, int zoneZ, const LookupFn& lookup);
+
+    // --- Statistics ---
+    uint64_t getHits() const;
+    uint64_t getMisses() const;
+    void resetCounters();
+
+private:
+    std::atomic<Chunk*>& cell(int chunkX, int chunkZ);
+    const std::atomic<Chunk*>& cell(int chunkX, int chunkZ) const;
+    bool inWindow(int chunkX, int chunkZ) const;
+
+    int m_zoneRadius;
+    // Cells per side, a power of two at least as wide as the largest window
+    int m_size;
+    int m_mask;
+    std::vector<std::atomic<Chunk*>> m_cells;
+    // The chunk coordinates of the window's lower-left corner
+    std::atomic<int> m_minX, m_minZ;
+    // Chunks per side of the window
+    std::atomic<int> m_width;
+    // The radius changed since the last recenter()
+    bool m_resized;
+
+    mutable std::atomic<uint64_t> m_hits;
+    mutable std::atomic<uint64_t> m_misses;
+};
+
+#endif // CHUNKRING_H
@@ -0,0 +1,177 @@
+#include "chunkscheduler.h"
+#include <algorithm>
+
+ChunkScheduler::ChunkScheduler(WorkStealingPool* pool)
+    : m_mutex(), m_queue(), m_scheduled(), m_nextSequence(0),
+    m_maxInFlight(2 * pool->threadCount()), m_inFlight(0), m_runners(), m_freeRunners(),
+    m_stats(), mp_pool(pool)
+{
+    resetStats();
+}
+
+ChunkScheduler::~ChunkScheduler() {
+    cancelIf([](const Chunk*, JobKind) { return true; });
+    mp_pool->waitForDone();
+}
+
+bool ChunkScheduler::lessUrgent(const Job& a, const Job& b) {
+    if (a.priority != b.priority) {
+        return a.priority > b.priority;
+    }
+    return a.sequence > b.sequence;
+}
+
+bool ChunkScheduler::schedule(Chunk* chunk, JobKind kind, float priority, StageMask stages) {
+    QMutexLocker locker(&m_mutex);
+    std::array<bool, NUM_JOB_KINDS>& scheduled = m_scheduled[chunk];
+    if (scheduled[kind]) {
+        return false;
+    }
+    scheduled[kind] = true;
+
+    m_queue.push_back(Job{chunk, kind, priority, m_nextSequence++, stages, Clock::now()});
+    std::push_heap(m_queue.begin(), m_queue.end(), lessUrgent);
+    m_stats[kind].queued++;
+    return true;
+}
+
+void ChunkScheduler::takeJobs(std::vector<QRunnable*>& runners) {
+    while (m_inFlight < m_maxInFlight && !m_queue.empty()) {
+        std::pop_heap(m_queue.begin(), m_queue.end(), lessUrgent);
+        if (m_freeRunners.empty()) {
+            m_runners.push_back(mkU<JobRunner>(this));
+            m_freeRunners.push_back(m_runners.back().get());
+        }
+        JobRunner* runner = m_freeRunners.back();
+        m_freeRunners.pop_back();
+        runner->m_job = m_queue.back();
+        m_queue.pop_back();
+        m_inFlight++;
+        runners.push_back(runner);
+    }
+}
+
+void ChunkScheduler::dispatch() {
+    std::vector<QRunnable*> runners;
+    m_mutex.lock();
+    takeJobs(runners);
+    m_mutex.unlock();
+    // Spread over the deques in one pass, idle workers steal the rest
+    mp_pool->startBatch(runners);
+}
+
+bool ChunkScheduler::isScheduled(const Chunk* chunk, JobKind kind) const {
+    QMutexLocker locker(&m_mutex);
+    auto it = m_scheduled.find(chunk);
+    return it != m_scheduled.end() && it->second[kind];
+}
+
+void ChunkScheduler::updatePriorities(const PriorityFn& priority) {
+    QMutexLocker locker(&m_mutex);
+    for (Job& job : m_queue) {
+        job.priority = priority(job.chunk, job.kind);
+    }
+    std::make_heap(m_queue.begin(), m_queue.end(), lessUrgent);
+}
+
+void ChunkScheduler::discard(const Job& job) {
+    std::array<bool, NUM_JOB_KINDS>& scheduled = m_scheduled[job.chunk];
+    scheduled[job.kind] = false;
+    if (std::none_of(scheduled.begin(), scheduled.end(), [](bool b) { return b; })) {
+        m_scheduled.erase(job.chunk);
+    }
+}
+
+std::vector<Chunk*> ChunkScheduler::cancelIf(const JobFilter& filter) {
+    std::vector<Chunk*> cancelled;
+    QMutexLocker locker(&m_mutex);
+    auto keep = std::partition(m_queue.begin(), m_queue.end(), [&](const Job& job) {
+        return !filter(job.chunk, job.kind);
+    });
+    for (auto it = keep; it != m_queue.end(); ++it) {
+        cancelled.push_back(it->chunk);
+        m_stats[it->kind].queued--;
+        m_stats[it->kind].cancelled++;
+        discard(*it);
+    }
+    if (keep != m_queue.end()) {
+        m_queue.erase(keep, m_queue.end());
+        std::make_heap(m_queue.begin(), m_queue.end(), lessUrgent);
+    }
+    return cancelled;
+}
+
+bool ChunkScheduler::cancel(const Chunk* chunk) {
+    cancelIf([chunk](const Chunk* c, JobKind) { return c == chunk; });
+    QMutexLocker locker(&m_mutex);
+    return m_scheduled.find(chunk) != m_scheduled.end();
+}
+
+void ChunkScheduler::runJob(JobRunner& runner) {
+    Job& job = runner.m_job;
+    Clock::time_point start = Clock::now();
+    m_mutex.lock();
+    KindStats& stats = m_stats[job.kind];
+    stats.queued--;
+    stats.running++;
+    uint64_t wait = std::chrono::duration_cast<std::chrono::nanoseconds>(start - job.queuedAt).count();
+    stats.waitNanoseconds += wait;
+    stats.maxWaitNanoseconds = std::max(stats.maxWaitNanoseconds, wait);
+    m_mutex.unlock();
+
+    QRunnable* worker;
+    if (job.kind == GENERATE) {
+        runner.m_generateWorker.setChunk(job.chunk, job.stages);
+        worker = &runner.m_generateWorker;
+    } else {
+        runner.m_meshWorker.setChunk(job.chunk);
+        worker = &runner.m_meshWorker;
+    }
+    worker->run();
+
+    Clock::time_point end = Clock::now();
+    std::vector<QRunnable*> next;
+    m_mutex.lock();
+    stats.running--;
+    stats.completed++;
+    stats.runNanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    // Only now another job of this kind may be scheduled for the chunk
+    discard(job);
+    m_inFlight--;
+    // The runner isn't touched anymore after this, it may be reused right away
+    m_freeRunners.push_back(&runner);
+    takeJobs(next);
+    m_mutex.unlock();
+    // Submitted from a pool thread, so the jobs go to this worker's deque
+    for (QRunnable* r : next) {
+        mp_pool->start(r);
+    }
+}
+
+void ChunkScheduler::waitForDone() {
+    // Jobs that are only queued start once something dispatches them
+    dispatch();
+    mp_pool->waitForDone();
+}
+
+ChunkScheduler::KindStats ChunkScheduler::getStats(JobKind kind) const {
+    QMutexLocker locker(&m_mutex);
+    return m_stats[kind];
+}
+
+void ChunkScheduler::resetStats() {
+    QMutexLocker locker(&m_mutex);
+    for (KindStats& stats : m_stats) {
+        // Queue depths describe the current state and are kept
+        stats.completed = 0;
+        stats.cancelled = 0;
+        stats.waitNanoseconds = 0;
+        stats.maxWaitNanoseconds = 0;
+        stats.runNanoseconds = 0;
+    }
+}
+
+size_t ChunkScheduler::getJobObjectCount() const {
+    QMutexLocker locker(&m_mutex);
+    return m_runners.size();
+}
@@ -0,0 +1,142 @@
+#ifndef CHUNKSCHEDULER_H
+#define CHUNKSCHEDULER_H
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+#include <vector>
+#include <QMutex>
+#include <QRunnable>
+#include "blocktypeworker.h"
+#include "vboworker.h"
+#include "workstealingpool.h"
+
+// Runs the per-chunk background work (block generation and meshing)
+// on the terrain's worker pool.
+//  - At most one job per chunk and kind is queued or running at a time,
+//    scheduling another one is a no-op until the first one finishes.
+//  - Queued jobs run in order of priority (lower value first), and the
+//    priorities can be updated while the jobs wait, e.g. as the player moves.
+//  - Queued jobs can be cancelled, running ones always finish.
+//
+// Jobs wait in a priority heap and are handed to the pool's deques a few
+// at a time: dispatch() sends the most urgent ones as one batch, and every
+// finished job sends the next one to its own worker's deque. Only a small
+// window of jobs is in the deques, since those can't be reprioritized or
+// cancelled anymore. The job objects (with their BlockTypeWorker and
+// VBOWorker) are reused, so scheduling a job doesn't allocate.
+class ChunkScheduler {
+public:
+    enum JobKind : unsigned char {
+        GENERATE,   // BlockTypeWorker
+        MESH,       // VBOWorker
+        NUM_JOB_KINDS
+    };
+
+    typedef std::function<float(const Chunk*, JobKind)> PriorityFn;
+    typedef std::function<bool(const Chunk*, JobKind)> JobFilter;
+
+    struct KindStats {
+        size_t queued;          // Waiting for a thread
+        size_t running;
+        uint64_t completed;
+        uint64_t cancelled;
+        uint64_t waitNanoseconds;   // Total time completed jobs spent queued
+        uint64_t maxWaitNanoseconds;
+        uint64_t runNanoseconds;    // Total time spent running completed jobs
+    };
+
+    // At most twice as many jobs as the pool has threads
+    // are in the pool's deques at the same time
+    ChunkScheduler(WorkStealingPool* pool);
+    // Drops all queued jobs and waits for the running ones
+    ~ChunkScheduler();
+
+    // Queue a job of the kind for the chunk, generation jobs run the given
+    // stages. Returns false if a job of the same kind is already queued or
+    // running for this chunk. The job only starts once dispatch() is called
+    // or another job finishes.
+    bool schedule(Chunk* chunk, JobKind kind, float priority,
+                  StageMask stages = ALL_GENERATION_STAGES);
+    // Send the most urgent queued jobs to the pool, as one batch
+    void dispatch();
+    // Is a job of this kind queued or running for the chunk?
+    bool isScheduled(const Chunk* chunk, JobKind kind) const;
+
+    // Recompute the priority of every queued job
+    void updatePriorities(const PriorityFn& priority);
+
+    // Remove the queued jobs matching the filter and return their chunks
+    std::vector<Chunk*> cancelIf(const JobFilter& filter);
+    // Remove the queued jobs of the chunk. Returns whether a job of the
+    // chunk is still running afterwards.
+    bool cancel(const Chunk* chunk);
+
+    // Block until all queued and running jobs are done
+    // (along with everything else running on the pool)
+    void waitForDone();
+
+    // --- Statistics ---
+    KindStats getStats(JobKind kind) const;
+    void resetStats();
+    // Job objects allocated so far, they are reused afterwards
+    size_t getJobObjectCount() const;
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Job {
+        Chunk* chunk;
+        JobKind kind;
+        float priority;
+        // Breaks ties in FIFO order
+        uint64_t sequence;
+        StageMask stages;
+        Clock::time_point queuedAt;
+    };
+    // Heap comparator, the top of the heap is the most urgent job
+    static bool lessUrgent(const Job& a, const Job& b);
+
+    // A job handed to the pool. Doesn't auto-delete, it goes back to
+    // m_freeRunners once it ran.
+    class JobRunner : public QRunnable {
+    public:
+        JobRunner(ChunkScheduler* scheduler)
+            : mp_scheduler(scheduler), m_job(), m_generateWorker(nullptr), m_meshWorker(nullptr)
+        {
+            setAutoDelete(false);
+        }
+        void run() override { mp_scheduler->runJob(*this); }
+
+        ChunkScheduler* mp_scheduler;
+        Job m_job;
+        BlockTypeWorker m_generateWorker;
+        VBOWorker m_meshWorker;
+    };
+
+    // Body of the job runners
+    void runJob(JobRunner& runner);
+    // Pop the most urgent jobs into free runners while fewer than
+    // m_maxInFlight are in the pool. Needs m_mutex.
+    void takeJobs(std::vector<QRunnable*>& runners);
+    void discard(const Job& job);
+
+    // Protects everything below
+    mutable QMutex m_mutex;
+    std::vector<Job> m_queue;
+    // For every chunk with a queued or running job, which kinds it has
+    std::unordered_map<const Chunk*, std::array<bool, NUM_JOB_KINDS>> m_scheduled;
+    uint64_t m_nextSequence;
+    // Jobs in the pool's deques or running
+    int m_maxInFlight;
+    int m_inFlight;
+    std::vector<uPtr<JobRunner>> m_runners;
+    std::vector<JobRunner*> m_freeRunners;
+    std::array<KindStats, NUM_JOB_KINDS> m_stats;
+
+    WorkStealingPool* mp_pool;
+};
+
+#endif // CHUNKSCHEDULER_H
@@ -0,0 +1,95 @@
+#include "cullingboxes.h"
+#if defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+#define CULLINGBOXES_SSE
+#endif
+
+CullingBoxes::CullingBoxes()
+    : m_minX(), m_minY(), m_minZ(), m_maxX(), m_maxY(), m_maxZ()
+{}
+
+void CullingBoxes::clear() {
+    m_minX.clear();
+    m_minY.clear();
+    m_minZ.clear();
+    m_maxX.clear();
+    m_maxY.clear();
+    m_maxZ.clear();
+}
+
+void CullingBoxes::reserve(size_t count) {
+    m_minX.reserve(count);
+    m_minY.reserve(count);
+    m_minZ.reserve(count);
+    m_maxX.reserve(count);
+    m_maxY.reserve(count);
+    m_maxZ.reserve(count);
+}
+
+size_t CullingBoxes::size() const {
+    return m_minX.size();
+}
+
+size_t CullingBoxes::add(const glm::vec3& minCorner, const glm::vec3& maxCorner) {
+    m_minX.push_back(minCorner.x);
+    m_minY.push_back(minCorner.y);
+    m_minZ.push_back(minCorner.z);
+    m_maxX.push_back(maxCorner.x);
+    m_maxY.push_back(maxCorner.y);
+    m_maxZ.push_back(maxCorner.z);
+    return m_minX.size() - 1;
+}
+
+void CullingBoxes::setHeightRange(size_t index, float minY, float maxY) {
+    m_minY[index] = minY;
+    m_maxY[index] = maxY;
+}
+
+void CullingBoxes::cull(const std::array<glm::vec4, 6>& frustumPlanes, size_t begin, size_t end, uint8_t* visible) const {
+    // For every plane, the corner of a box furthest along the plane's normal
+    // takes the max coordinate on the axes where the normal is positive.
+    // That only depends on the plane, so pick the arrays once per plane
+    // instead of once per box.
+    std::array<const float*, 6> xs, ys, zs;
+    for (int p = 0; p < 6; ++p) {
+        xs[p] = frustumPlanes[p].x >= 0.f ? m_maxX.data() : m_minX.data();
+        ys[p] = frustumPlanes[p].y >= 0.f ? m_maxY.data() : m_minY.data();
+        zs[p] = frustumPlanes[p].z >= 0.f ? m_maxZ.data() : m_minZ.data();
+    }
+
+    size_t i = begin;
+#ifdef CULLINGBOXES_SSE
+    __m128 a[6], b[6], c[6], d[6];
+    for (int p = 0; p < 6; ++p) {
+        a[p] = _mm_set1_ps(frustumPlanes[p].x);
+        b[p] = _mm_set1_ps(frustumPlanes[p].y);
+        c[p] = _mm_set1_ps(frustumPlanes[p].z);
+        d[p] = _mm_set1_ps(frustumPlanes[p].w);
+    }
+    const __m128 zero = _mm_setzero_ps();
+    for (; i + 4 <= end; i += 4) {
+        __m128 outside = zero;
+        for (int p = 0; p < 6; ++p) {
+            __m128 distance = _mm_add_ps(
+                _mm_add_ps(_mm_mul_ps(a[p], _mm_loadu_ps(xs[p] + i)),
+                           _mm_mul_ps(b[p], _mm_loadu_ps(ys[p] + i))),
+                _mm_add_ps(_mm_mul_ps(c[p], _mm_loadu_ps(zs[p] + i)), d[p]));
+            outside = _mm_or_ps(outside, _mm_cmplt_ps(distance, zero));
+        }
+        int mask = _mm_movemask_ps(outside);
+        visible[i - begin] = !(mask & 1);
+        visible[i - begin + 1] = !(mask & 2);
+        visible[i - begin + 2] = !(mask & 4);
+        visible[i - begin + 3] = !(mask & 8);
+    }
+#endif
+    // The remaining boxes (or all of them without SSE)
+    for (; i < end; ++i) {
+        bool inside = true;
+        for (int p = 0; p < 6 && inside; ++p) {
+            const glm::vec4& plane = frustumPlanes[p];
+            inside = plane.x * xs[p][i] + plane.y * ys[p][i] + plane.z * zs[p][i] + plane.w >= 0.f;
+        }
+        visible[i - begin] = inside;
+    }
+}
@@ -0,0 +1,38 @@
+#ifndef CULLINGBOXES_H
+#define CULLINGBOXES_H
+
+#include <array>
+#include <cstdint>
+#include <vector>
+#include "../glm_includes.h"
+
+// Axis-aligned bounding boxes stored as a structure of arrays (one array
+// per coordinate of the min and max corners), so that they can be tested
+// against the view frustum four at a time with SSE. Builds without SSE
+// run the same loop scalar.
+//
+// The frustum planes are the ones of Camera::getFrustumPlanes, pointing
+// inwards. A box is visible unless it lies entirely behind one plane.
+class CullingBoxes {
+public:
+    CullingBoxes();
+
+    void clear();
+    void reserve(size_t count);
+    size_t size() const;
+
+    // Append a box and return its index
+    size_t add(const glm::vec3& minCorner, const glm::vec3& maxCorner);
+    // Change the vertical extent of a box
+    void setHeightRange(size_t index, float minY, float maxY);
+
+    // Test the boxes in [begin, end) against the frustum,
+    // visible[i - begin] is set to 1 if box i intersects it and 0 otherwise
+    void cull(const std::array<glm::vec4, 6>& frustumPlanes, size_t begin, size_t end, uint8_t* visible) const;
+
+private:
+    std::vector<float> m_minX, m_minY, m_minZ;
+    std::vector<float> m_maxX, m_maxY, m_maxZ;
+};
+
+#endif // CULLINGBOXES_H
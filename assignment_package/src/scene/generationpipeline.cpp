@@ -0,0 +1,223 @@
+#include "generationpipeline.h"
+#include "chunk.h"
+#include <bitset>
+#include <chrono>
+#include <cmath>
+
+// Chunk dimensions, see chunk.cpp
+const static int chunkXLength = 16;
+const static int chunkYLength = 256;
+const static int chunkZLength = 16;
+
+// Generation constants
+const static int caveMinHeight = 40; // increase to reduce load time
+const static int caveMaxHeight = 80;
+const static int lavaHeight = caveMinHeight + 5;
+const static int oceanHeight = 140;
+const static int riverDepth = 4;
+const static int seaLevel = 138;
+
+static const char* stageNames[DECORATION] = {
+    "heightfield", "surface", "caves", "rivers", "fluids"
+};
+
+static inline int blockIndex(int x, int y, int z) {
+    return x + chunkXLength * y + chunkXLength * chunkYLength * z;
+}
+
+GenerationPipeline::GenerationPipeline(NoiseTileCache* noiseTiles, const RiverRegistry* rivers)
+    : mp_noiseTiles(noiseTiles), mp_rivers(rivers), m_decorations()
+{
+    resetStageStats();
+}
+
+void GenerationPipeline::generate(BlockType* blocks, int minX, int minZ, StageMask stages, bool clear) {
+    ChunkGenContext ctx;
+    ctx.blocks = blocks;
+    ctx.minX = minX;
+    ctx.minZ = minZ;
+
+    // Heights and biomes are shared by every chunk in the zone
+    int zoneX = static_cast<int>(std::floor(minX / 64.f));
+    int zoneZ = static_cast<int>(std::floor(minZ / 64.f));
+    sPtr<const NoiseTile> tile = mp_noiseTiles->getTile(zoneX, zoneZ);
+    int offsetX = minX - zoneX * NoiseTile::SIZE;
+    int offsetZ = minZ - zoneZ * NoiseTile::SIZE;
+    for (int z = 0; z < chunkZLength; ++z) {
+        for (int x = 0; x < chunkXLength; ++x) {
+            ctx.heights[x + chunkXLength * z] = tile->getHeight(x + offsetX, z + offsetZ);
+            ctx.biomes[x + chunkXLength * z] = tile->getBiome(x + offsetX, z + offsetZ);
+        }
+    }
+
+    if (clear) {
+        std::fill_n(blocks, chunkXLength * chunkYLength * chunkZLength, EMPTY);
+    }
+
+    auto runTimed = [&](GenerationStage stage, auto&& fn) {
+        if (!(stages & stageBit(stage))) {
+            return;
+        }
+        auto start = std::chrono::steady_clock::now();
+        fn(ctx);
+        auto end = std::chrono::steady_clock::now();
+        m_stageRuns[stage]++;
+        m_stageNanoseconds[stage] += std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    };
+
+    runTimed(HEIGHTFIELD, heightfieldStage);
+    runTimed(SURFACE, surfaceStage);
+    runTimed(CAVES, caveStage);
+    runTimed(RIVERS, [this](ChunkGenContext& c) { riverStage(c); });
+    runTimed(FLUIDS, fluidStage);
+
+    if ((stages & stageBit(DECORATION)) && !m_decorations.empty()) {
+        for (Decoration& d : m_decorations) {
+            auto start = std::chrono::steady_clock::now();
+            d.fn(ctx);
+            auto end = std::chrono::steady_clock::now();
+            (*d.runs)++;
+            (*d.nanoseconds) += std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+        }
+    }
+}
+
+void GenerationPipeline::addDecorationStage(const std::string& name, DecorationFn fn) {
+    m_decorations.push_back(Decoration{name, std::move(fn),
+                                       mkU<std::atomic<uint64_t>>(0),
+                                       mkU<std::atomic<uint64_t>>(0)});
+}
+
+std::vector<GenerationPipeline::StageStats> GenerationPipeline::getStageStats() const {
+    std::vector<StageStats> stats;
+    for (int i = 0; i < DECORATION; ++i) {
+        stats.push_back(StageStats{stageNames[i], m_stageRuns[i], m_stageNanoseconds[i]});
+    }
+    for (const Decoration& d : m_decorations) {
+        stats.push_back(StageStats{d.name, *d.runs, *d.nanoseconds});
+    }
+    return stats;
+}
+
+void GenerationPipeline::resetStageStats() {
+    for (int i = 0; i < DECORATION; ++i) {
+        m_stageRuns[i] = 0;
+        m_stageNanoseconds[i] = 0;
+    }
+    for (Decoration& d : m_decorations) {
+        *d.runs = 0;
+        *d.nanoseconds = 0;
+    }
+}
+
+// Bedrock at the bottom, solid stone up to (and including) the surface
+void GenerationPipeline::heightfieldStage(ChunkGenContext& ctx) {
+    for (int z = 0; z < chunkZLength; ++z) {
+        for (int x = 0; x < chunkXLength; ++x) {
+            int height = ctx.heights[x + chunkXLength * z];
+            ctx.blocks[blockIndex(x, 0, z)] = BEDROCK;
+            for (int y = 1; y <= height; ++y) {
+                ctx.blocks[blockIndex(x, y, z)] = STONE;
+            }
+        }
+    }
+}
+
+// Grassland gets grass on top of dirt,
+// mountains stay stone and get snow caps above 200
+void GenerationPipeline::surfaceStage(ChunkGenContext& ctx) {
+    for (int z = 0; z < chunkZLength; ++z) {
+        for (int x = 0; x < chunkXLength; ++x) {
+            int height = ctx.heights[x + chunkXLength * z];
+            if (height <= 0) {
+                continue;
+            }
+            if (ctx.biomes[x + chunkXLength * z] == BiomeNoise::GRASSLAND) {
+                for (int y = 1; y < height; ++y) {
+                    ctx.blocks[blockIndex(x, y, z)] = DIRT;
+                }
+                ctx.blocks[blockIndex(x, height, z)] = GRASS;
+            } else if (height > 200) {
+                ctx.blocks[blockIndex(x, height, z)] = SNOW;
+            }
+        }
+    }
+}
+
+// Carve caves out of a band of underground Y values,
+// with lava pooling at the bottom of the band
+void GenerationPipeline::caveStage(ChunkGenContext& ctx) {
+    for (int z = 0; z < chunkZLength; ++z) {
+        for (int x = 0; x < chunkXLength; ++x) {
+            float worldX = static_cast<float>(ctx.minX + x);
+            float worldZ = static_cast<float>(ctx.minZ + z);
+            for (int y = caveMinHeight; y < caveMaxHeight; ++y) {
+                float noise = BiomeNoise::perlin3D(worldX * 0.1f, y * 0.1f, worldZ * 0.1f);
+                if (noise < 0.0f) {
+                    ctx.blocks[blockIndex(x, y, z)] = y < lavaHeight ? LAVA : EMPTY;
+                }
+            }
+        }
+    }
+}
+
+// Replace the top of every river column with water and a dirt river bed.
+// Rivers only run through terrain above the ocean.
+void GenerationPipeline::riverStage(ChunkGenContext& ctx) const {
+    if (!mp_rivers) {
+        return;
+    }
+
+    // Rasterize the rivers into a mask of the chunk's columns once, only
+    // probing the rivers of the chunk's zone whose bounding box touches it
+    std::bitset<chunkXLength * chunkZLength> riverMask;
+    int maxX = ctx.minX + chunkXLength - 1;
+    int maxZ = ctx.minZ + chunkZLength - 1;
+    // Rivers added while this chunk generates are picked up by the next one
+    for (const Rivers& r : mp_rivers->snapshot(ctx.minX, ctx.minZ)) {
+        if (!r.overlaps(ctx.minX, ctx.minZ, maxX, maxZ)) {
+            continue;
+        }
+        for (int z = 0; z < chunkZLength; ++z) {
+            for (int x = 0; x < chunkXLength; ++x) {
+                int column = x + chunkXLength * z;
+                if (!riverMask[column] && ctx.heights[column] > oceanHeight
+                    && r.isRiverAt(ctx.minX + x, ctx.minZ + z)) {
+                    riverMask.set(column);
+                }
+            }
+        }
+    }
+    if (riverMask.none()) {
+        return;
+    }
+
+    for (int z = 0; z < chunkZLength; ++z) {
+        for (int x = 0; x < chunkXLength; ++x) {
+            if (!riverMask[x + chunkXLength * z]) {
+                continue;
+            }
+            int height = ctx.heights[x + chunkXLength * z];
+            ctx.blocks[blockIndex(x, height, z)] = EMPTY;
+            for (int y = oceanHeight - riverDepth + 1; y < height; ++y) {
+                ctx.blocks[blockIndex(x, y, z)] = WATER;
+            }
+            ctx.blocks[blockIndex(x, oceanHeight - riverDepth - 1, z)] = DIRT;
+        }
+    }
+}
+
+// Fill the air above low terrain with water up to sea level
+void GenerationPipeline::fluidStage(ChunkGenContext& ctx) {
+    for (int z = 0; z < chunkZLength; ++z) {
+        for (int x = 0; x < chunkXLength; ++x) {
+            int height = ctx.heights[x + chunkXLength * z];
+            if (height >= seaLevel) {
+                continue;
+            }
+            for (int y = std::max(height + 1, caveMaxHeight + 1); y <= seaLevel; ++y) {
+                ctx.blocks[blockIndex(x, y, z)] = WATER;
+            }
+        }
+    }
+}
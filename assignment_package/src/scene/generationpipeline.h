@@ -0,0 +1,100 @@
+#ifndef GENERATIONPIPELINE_H
+#define GENERATIONPIPELINE_H
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+#include "../smartpointerhelp.h"
+#include "noisetilecache.h"
+#include "riverregistry.h"
+
+// Defined in chunk.h, declared here so that Chunk can include this header
+enum BlockType : unsigned char;
+
+// The stages of world generation, in the order in which they run.
+// Every stage is a bulk pass over the whole chunk.
+enum GenerationStage : unsigned char {
+    HEIGHTFIELD,    // Bedrock and solid stone up to the surface height
+    SURFACE,        // Biome dependent surface and sub-surface blocks
+    CAVES,          // 3D noise caves and lava pockets
+    RIVERS,         // L-system river beds and river water
+    FLUIDS,         // Ocean water filling up low terrain
+    DECORATION,     // All stages added through addDecorationStage
+    NUM_GENERATION_STAGES
+};
+
+// Bit mask of GenerationStages, used to skip stages (e.g. caves for far chunks)
+typedef unsigned int StageMask;
+const StageMask ALL_GENERATION_STAGES = (1u << NUM_GENERATION_STAGES) - 1;
+
+inline StageMask stageBit(GenerationStage stage) {
+    return 1u << stage;
+}
+
+// Everything a stage needs to know about the chunk it fills.
+// Blocks are indexed the same way as in Chunk
+// (x + 16 * y + 16 * 256 * z), columns as x + 16 * z.
+struct ChunkGenContext {
+    BlockType* blocks;
+    int minX, minZ;
+    std::array<uint8_t, 256> heights;
+    std::array<uint8_t, 256> biomes;
+};
+
+// Turns chunk coordinates into block data by running the generation
+// stages one after another. One pipeline is shared by all chunks of a
+// Terrain and can be used from several worker threads at once.
+class GenerationPipeline {
+public:
+    typedef std::function<void(ChunkGenContext&)> DecorationFn;
+
+    struct StageStats {
+        std::string name;
+        uint64_t runs;
+        uint64_t nanoseconds;
+    };
+
+    GenerationPipeline(NoiseTileCache* noiseTiles, const RiverRegistry* rivers);
+
+    // Fill the 16 x 256 x 16 blocks of the chunk with its lower-left corner
+    // at (minX, minZ), running only the stages in the mask.
+    // If clear is false, the stages are applied on top of the existing blocks,
+    // which is used to run stages that were skipped before.
+    void generate(BlockType* blocks, int minX, int minZ, StageMask stages, bool clear = true);
+
+    // Register an additional stage that runs after the built-in ones.
+    // Decorations are not synchronized with running generation jobs,
+    // so they have to be added before the Terrain starts generating.
+    void addDecorationStage(const std::string& name, DecorationFn fn);
+
+    // --- Statistics ---
+    // Number of runs and total time spent in every stage (decorations individually)
+    std::vector<StageStats> getStageStats() const;
+    void resetStageStats();
+
+private:
+    struct Decoration {
+        std::string name;
+        DecorationFn fn;
+        uPtr<std::atomic<uint64_t>> runs;
+        uPtr<std::atomic<uint64_t>> nanoseconds;
+    };
+
+    static void heightfieldStage(ChunkGenContext& ctx);
+    static void surfaceStage(ChunkGenContext& ctx);
+    static void caveStage(ChunkGenContext& ctx);
+    void riverStage(ChunkGenContext& ctx) const;
+    static void fluidStage(ChunkGenContext& ctx);
+
+    NoiseTileCache* mp_noiseTiles;
+    const RiverRegistry* mp_rivers;
+    std::vector<Decoration> m_decorations;
+
+    std::array<std::atomic<uint64_t>, DECORATION> m_stageRuns;
+    std::array<std::atomic<uint64_t>, DECORATION> m_stageNanoseconds;
+};
+
+#endif // GENERATIONPIPELINE_H
@@ -0,0 +1,348 @@
+#include "mesharena.h"
+#include <algorithm>
+#include <cstring>
+
+// Capacity of the buffers when the first mesh is uploaded, in elements.
+// A chunk at full detail has a few thousand vertices.
+const static size_t INITIAL_VERTEX_CAPACITY = 1 << 18;
+const static size_t INITIAL_INDEX_CAPACITY = 1 << 19;
+// Size of the staging buffer in bytes, about a frame's worth of uploads
+// (see Terrain's upload budget). Larger meshes get a larger buffer.
+const static size_t STAGING_CAPACITY = 4 << 20;
+// Alignment of the staged meshes in the staging buffer
+const static size_t STAGING_ALIGNMENT = 64;
+
+static size_t alignUp(size_t size, size_t alignment) {
+    return (size + alignment - 1) / alignment * alignment;
+}
+
+void MeshArena::DrawList::clear() {
+    counts.clear();
+    indexOffsets.clear();
+    baseVertices.clear();
+}
+
+size_t MeshArena::DrawList::size() const {
+    return counts.size();
+}
+
+MeshArena::RangeAllocator::RangeAllocator()
+    : m_free(), m_capacity(0), m_used(0)
+{}
+
+bool MeshArena::RangeAllocator::allocate(size_t size, size_t& offset) {
+    // First fit, which keeps the start of the buffer dense
+    for (auto it = m_free.begin(); it != m_free.end(); ++it) {
+        if (it->second < size) {
+            continue;
+        }
+        offset = it->first;
+        size_t remaining = it->second - size;
+        m_free.erase(it);
+        if (remaining > 0) {
+            m_free[offset + size] = remaining;
+        }
+        m_used += size;
+        return true;
+    }
+    return false;
+}
+
+void MeshArena::RangeAllocator::free(size_t offset, size_t size) {
+    m_used -= size;
+    auto it = m_free.emplace(offset, size).first;
+    // Merge with the free ranges right after and right before it
+    auto next = std::next(it);
+    if (next != m_free.end() && it->first + it->second == next->first) {
+        it->second += next->second;
+        m_free.erase(next);
+    }
+    if (it != m_free.begin()) {
+        auto previous = std::prev(it);
+        if (previous->first + previous->second == it->first) {
+            previous->second += it->second;
+            m_free.erase(it);
+        }
+    }
+}
+
+void MeshArena::RangeAllocator::reset(size_t capacity, size_t used) {
+    m_free.clear();
+    if (used < capacity) {
+        m_free[used] = capacity - used;
+    }
+    m_capacity = capacity;
+    m_used = used;
+}
+
+size_t MeshArena::RangeAllocator::getCapacity() const {
+    return m_capacity;
+}
+
+size_t MeshArena::RangeAllocator::getUsed() const {
+    return m_used;
+}
+
+size_t MeshArena::RangeAllocator::getFreeRangeCount() const {
+    return m_free.size();
+}
+
+MeshArena::MeshArena(OpenGLContext* context, size_t vertexSize)
+    : mp_context(context), m_vertexSize(vertexSize), m_vertexBuffer(0), m_indexBuffer(0),
+    m_vertexArray(0), m_vertexArrayOutdated(true),
+    m_vertexRanges(), m_indexRanges(), m_meshes(), m_freeHandles(), m_liveMeshes(0),
+    m_stagingBuffer(0), m_stagingCapacity(0), m_stagingOffset(0),
+    m_defragmentations(0), m_growths(0), m_stagingOrphans(0)
+{}
+
+MeshArena::~MeshArena() {
+    destroy();
+}
+
+MeshArena::Handle MeshArena::upload(const void* vertices, size_t vertexCount, const GLuint* indices, size_t indexCount) {
+    if (vertexCount == 0 || indexCount == 0) {
+        return NO_MESH;
+    }
+    // Allocate before the mesh is live, so that compacting doesn't copy it
+    size_t vertexOffset = allocate(VERTICES, vertexCount);
+    size_t indexOffset = allocate(INDICES, indexCount);
+
+    Handle mesh;
+    if (m_freeHandles.empty()) {
+        mesh = static_cast<Handle>(m_meshes.size());
+        m_meshes.push_back(Mesh());
+    } else {
+        mesh = m_freeHandles.back();
+        m_freeHandles.pop_back();
+    }
+    m_meshes[mesh] = Mesh{vertexOffset, vertexCount, indexOffset, indexCount, true};
+    m_liveMeshes++;
+
+    // The copy targets leave the bindings of the vertex array object alone
+    size_t vertexBytes = vertexCount * m_vertexSize;
+    size_t indexBytes = indexCount * sizeof(GLuint);
+    size_t stagedVertices, stagedIndices;
+    stage(vertices, vertexBytes, indices, indexBytes, stagedVertices, stagedIndices);
+    mp_context->glBindBuffer(GL_COPY_WRITE_BUFFER, m_vertexBuffer);
+    mp_context->glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, stagedVertices,
+                                    vertexOffset * m_vertexSize, vertexBytes);
+    mp_context->glBindBuffer(GL_COPY_WRITE_BUFFER, m_indexBuffer);
+    mp_context->glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, stagedIndices,
+                                    indexOffset * sizeof(GLuint), indexBytes);
+    return mesh;
+}
+
+void MeshArena::updateIndices(Handle mesh, const GLuint* indices) {
+    if (mesh == NO_MESH) {
+        return;
+    }
+    const Mesh& m = m_meshes[mesh];
+    // Copied on the GPU like an upload, after the draws that still use the old ones
+    size_t indexBytes = m.indexCount * sizeof(GLuint);
+    size_t stagedVertices, stagedIndices;
+    stage(nullptr, 0, indices, indexBytes, stagedVertices, stagedIndices);
+    mp_context->glBindBuffer(GL_COPY_WRITE_BUFFER, m_indexBuffer);
+    mp_context->glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, stagedIndices,
+                                    m.indexOffset * sizeof(GLuint), indexBytes);
+}
+
+void MeshArena::release(Handle mesh) {
+    if (mesh == NO_MESH) {
+        return;
+    }
+    Mesh& m = m_meshes[mesh];
+    m_vertexRanges.free(m.vertexOffset, m.vertexCount);
+    m_indexRanges.free(m.indexOffset, m.indexCount);
+    m.live = false;
+    m_liveMeshes--;
+    m_freeHandles.push_back(mesh);
+}
+
+void MeshArena::appendDraw(Handle mesh, DrawList& draws) const {
+    if (mesh == NO_MESH) {
+        return;
+    }
+    const Mesh& m = m_meshes[mesh];
+    draws.counts.push_back(static_cast<GLsizei>(m.indexCount));
+    draws.indexOffsets.push_back(reinterpret_cast<const void*>(m.indexOffset * sizeof(GLuint)));
+    draws.baseVertices.push_back(static_cast<GLint>(m.vertexOffset));
+}
+
+bool MeshArena::bind(bool& formatOutdated) {
+    formatOutdated = false;
+    if (m_vertexBuffer == 0) {
+        return false;
+    }
+    if (m_vertexArray == 0) {
+        mp_context->glGenVertexArrays(1, &m_vertexArray);
+    }
+    mp_context->glBindVertexArray(m_vertexArray);
+    if (m_vertexArrayOutdated) {
+        // The element array binding is part of the vertex array's state,
+        // the attribute pointers capture the GL_ARRAY_BUFFER binding
+        mp_context->glBindBuffer(GL_ARRAY_BUFFER, m_vertexBuffer);
+        mp_context->glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_indexBuffer);
+        m_vertexArrayOutdated = false;
+        formatOutdated = true;
+    }
+    return true;
+}
+
+void MeshArena::destroy() {
+    if (m_vertexBuffer != 0) {
+        mp_context->glDeleteBuffers(1, &m_vertexBuffer);
+        mp_context->glDeleteBuffers(1, &m_indexBuffer);
+        m_vertexBuffer = 0;
+        m_indexBuffer = 0;
+    }
+    if (m_vertexArray != 0) {
+        mp_context->glDeleteVertexArrays(1, &m_vertexArray);
+        m_vertexArray = 0;
+    }
+    if (m_stagingBuffer != 0) {
+        mp_context->glDeleteBuffers(1, &m_stagingBuffer);
+        m_stagingBuffer = 0;
+    }
+    m_stagingCapacity = 0;
+    m_stagingOffset = 0;
+    m_vertexArrayOutdated = true;
+    m_vertexRanges.reset(0, 0);
+    m_indexRanges.reset(0, 0);
+    m_meshes.clear();
+    m_freeHandles.clear();
+    m_liveMeshes = 0;
+}
+
+size_t MeshArena::getUsedBytes() const {
+    return m_vertexRanges.getUsed() * m_vertexSize + m_indexRanges.getUsed() * sizeof(GLuint);
+}
+
+MeshArena::Stats MeshArena::getStats() const {
+    return Stats{m_liveMeshes,
+                 m_vertexRanges.getCapacity(), m_vertexRanges.getUsed(), m_vertexRanges.getFreeRangeCount(),
+                 m_indexRanges.getCapacity(), m_indexRanges.getUsed(), m_indexRanges.getFreeRangeCount(),
+                 m_defragmentations, m_growths, m_stagingCapacity, m_stagingOrphans};
+}
+
+size_t MeshArena::allocate(Part part, size_t size) {
+    RangeAllocator& ranges = part == VERTICES ? m_vertexRanges : m_indexRanges;
+    size_t offset;
+    if (ranges.allocate(size, offset)) {
+        return offset;
+    }
+    size_t capacity = ranges.getCapacity();
+    size_t free = capacity - ranges.getUsed();
+    // Compacting only pays off if it leaves room for more than this mesh,
+    // otherwise the next upload would compact the whole buffer again
+    if (capacity > 0 && free >= size + capacity / 4) {
+        repack(part, capacity);
+        m_defragmentations++;
+    } else {
+        size_t newCapacity = std::max(capacity * 2, part == VERTICES ? INITIAL_VERTEX_CAPACITY : INITIAL_INDEX_CAPACITY);
+        while (newCapacity < ranges.getUsed() + size) {
+            newCapacity *= 2;
+        }
+        repack(part, newCapacity);
+        m_growths++;
+    }
+    ranges.allocate(size, offset);
+    return offset;
+}
+
+void MeshArena::repack(Part part, size_t capacity) {
+    GLuint& buffer = part == VERTICES ? m_vertexBuffer : m_indexBuffer;
+    size_t elementSize = part == VERTICES ? m_vertexSize : sizeof(GLuint);
+
+    GLuint newBuffer;
+    mp_context->glGenBuffers(1, &newBuffer);
+    mp_context->glBindBuffer(GL_COPY_WRITE_BUFFER, newBuffer);
+    mp_context->glBufferData(GL_COPY_WRITE_BUFFER, capacity * elementSize, nullptr, GL_DYNAMIC_DRAW);
+
+    // The live meshes in buffer order, so that runs of meshes that are
+    // already back to back are copied with a single call
+    std::vector<Mesh*> live;
+    live.reserve(m_liveMeshes);
+    for (Mesh& mesh : m_meshes) {
+        if (mesh.live) {
+            live.push_back(&mesh);
+        }
+    }
+    auto offsetOf = [part](Mesh* mesh) -> size_t& {
+        return part == VERTICES ? mesh->vertexOffset : mesh->indexOffset;
+    };
+    auto countOf = [part](const Mesh* mesh) {
+        return part == VERTICES ? mesh->vertexCount : mesh->indexCount;
+    };
+    std::sort(live.begin(), live.end(), [&](Mesh* a, Mesh* b) { return offsetOf(a) < offsetOf(b); });
+
+    if (buffer != 0) {
+        mp_context->glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+    }
+    size_t used = 0;
+    size_t runSource = 0, runTarget = 0, runLength = 0;
+    auto flushRun = [&]() {
+        if (runLength > 0) {
+            mp_context->glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, runSource * elementSize,
+                                            runTarget * elementSize, runLength * elementSize);
+        }
+    };
+    for (Mesh* mesh : live) {
+        size_t& offset = offsetOf(mesh);
+        if (runLength > 0 && runSource + runLength == offset) {
+            runLength += countOf(mesh);
+        } else {
+            flushRun();
+            runSource = offset;
+            runTarget = used;
+            runLength = countOf(mesh);
+        }
+        offset = used;
+        used += countOf(mesh);
+    }
+    flushRun();
+
+    if (buffer != 0) {
+        mp_context->glDeleteBuffers(1, &buffer);
+    }
+    buffer = newBuffer;
+    m_vertexArrayOutdated = true;
+    (part == VERTICES ? m_vertexRanges : m_indexRanges).reset(capacity, used);
+}
+
+void MeshArena::stage(const void* vertices, size_t vertexBytes, const GLuint* indices, size_t indexBytes,
+                      size_t& vertexOffset, size_t& indexOffset) {
+    size_t indexStart = alignUp(vertexBytes, STAGING_ALIGNMENT);
+    size_t size = indexStart + indexBytes;
+    if (m_stagingBuffer == 0) {
+        mp_context->glGenBuffers(1, &m_stagingBuffer);
+    }
+    mp_context->glBindBuffer(GL_COPY_READ_BUFFER, m_stagingBuffer);
+    if (m_stagingOffset + size > m_stagingCapacity) {
+        // Orphan the buffer: the copies still waiting to run keep reading the
+        // old storage, and everything written from now on goes to new storage
+        m_stagingCapacity = std::max(m_stagingCapacity, std::max(STAGING_CAPACITY, alignUp(size, STAGING_ALIGNMENT)));
+        mp_context->glBufferData(GL_COPY_READ_BUFFER, m_stagingCapacity, nullptr, GL_STREAM_DRAW);
+        m_stagingOffset = 0;
+        m_stagingOrphans++;
+    }
+    vertexOffset = m_stagingOffset;
+    indexOffset = m_stagingOffset + indexStart;
+
+    // Nothing has been written to this range since the orphaning,
+    // so the GPU can't be reading it and there is nothing to wait for
+    void* mapped = mp_context->glMapBufferRange(GL_COPY_READ_BUFFER, m_stagingOffset, size,
+                                                GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+    if (mapped != nullptr) {
+        if (vertexBytes > 0) {
+            std::memcpy(mapped, vertices, vertexBytes);
+        }
+        std::memcpy(static_cast<char*>(mapped) + indexStart, indices, indexBytes);
+        mp_context->glUnmapBuffer(GL_COPY_READ_BUFFER);
+    } else {
+        if (vertexBytes > 0) {
+            mp_context->glBufferSubData(GL_COPY_READ_BUFFER, vertexOffset, vertexBytes, vertices);
+        }
+        mp_context->glBufferSubData(GL_COPY_READ_BUFFER, indexOffset, indexBytes, indices);
+    }
+    m_stagingOffset = alignUp(m_stagingOffset + size, STAGING_ALIGNMENT);
+}
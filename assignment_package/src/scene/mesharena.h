@@ -0,0 +1,148 @@
+#ifndef MESHARENA_H
+#define MESHARENA_H
+
+#include <cstdint>
+#include <map>
+#include <vector>
+#include "../openglcontext.h"
+
+// One vertex buffer and one index buffer holding the meshes of all chunks,
+// so that the visible chunks can be drawn with a single
+// glMultiDrawElementsBaseVertex instead of a buffer bind, attribute setup
+// and draw call per chunk.
+//
+// Every mesh gets a range of each buffer from a free list. Indices are
+// relative to the mesh's first vertex (drawn with a base vertex), so
+// meshes can be moved without rewriting them. If no free range is large
+// enough, the buffer is compacted into a new one (defragmenting it), and
+// grown if the live meshes plus the new one don't fit anyway.
+//
+// Uploads don't write into the arena's buffers, which the GPU may still be
+// drawing from. They are written into a streaming staging buffer instead,
+// through unsynchronized mappings of ranges that weren't used since the
+// buffer was last orphaned, and then copied on the GPU. The CPU never
+// waits for the GPU during an upload.
+//
+// Meshes are referred to by handles, which stay valid while the meshes move.
+// The arena keeps its own vertex array object, so drawing it doesn't
+// re-specify the vertex attributes unless the buffers were replaced.
+// All functions have to be called with the OpenGL context current.
+class MeshArena {
+public:
+    typedef int Handle;
+    static const Handle NO_MESH = -1;
+
+    // The arguments of a multi-draw call, one entry per mesh
+    struct DrawList {
+        std::vector<GLsizei> counts;
+        std::vector<const void*> indexOffsets;
+        std::vector<GLint> baseVertices;
+
+        void clear();
+        size_t size() const;
+    };
+
+    struct Stats {
+        size_t meshes;
+        size_t vertexCapacity, verticesUsed, vertexFreeRanges;
+        size_t indexCapacity, indicesUsed, indexFreeRanges;
+        uint64_t defragmentations;
+        uint64_t growths;
+        size_t stagingCapacity;
+        uint64_t stagingOrphans; // Times the staging buffer was full and replaced
+    };
+
+    // Vertices are vertexSize bytes each, indices are GLuints
+    MeshArena(OpenGLContext* context, size_t vertexSize);
+    ~MeshArena();
+    MeshArena(const MeshArena&) = delete;
+    MeshArena& operator=(const MeshArena&) = delete;
+
+    // Copy a mesh into the arena. Returns NO_MESH for an empty mesh.
+    Handle upload(const void* vertices, size_t vertexCount, const GLuint* indices, size_t indexCount);
+    // Replace the mesh's indices with as many new ones, e.g. to draw its
+    // triangles in another order (does nothing for NO_MESH)
+    void updateIndices(Handle mesh, const GLuint* indices);
+    // Free the mesh's ranges (does nothing for NO_MESH)
+    void release(Handle mesh);
+    // Add the mesh to a draw list (does nothing for NO_MESH)
+    void appendDraw(Handle mesh, DrawList& draws) const;
+
+    // Bind the arena's vertex array object, which references both buffers.
+    // Returns false if nothing was uploaded yet. formatOutdated is set if
+    // the buffers were replaced since the last call: the vertex buffer is
+    // bound to GL_ARRAY_BUFFER then, and the caller has to specify the
+    // vertex attributes again. Bind the context's default vertex array
+    // when done drawing.
+    bool bind(bool& formatOutdated);
+    // Delete the buffers and the vertex array, all handles become invalid
+    void destroy();
+
+    // Bytes taken by the live meshes in both buffers
+    size_t getUsedBytes() const;
+    Stats getStats() const;
+
+private:
+    // Hands out ranges [offset, offset + size) of a buffer of
+    // capacity elements, keeping the free ranges sorted and merged
+    class RangeAllocator {
+    public:
+        RangeAllocator();
+        // Returns false if no free range is large enough
+        bool allocate(size_t size, size_t& offset);
+        void free(size_t offset, size_t size);
+        // Forget all ranges, [0, used) is taken and the rest is free
+        void reset(size_t capacity, size_t used);
+        size_t getCapacity() const;
+        size_t getUsed() const;
+        size_t getFreeRangeCount() const;
+    private:
+        // Free ranges by offset
+        std::map<size_t, size_t> m_free;
+        size_t m_capacity;
+        size_t m_used;
+    };
+
+    struct Mesh {
+        size_t vertexOffset, vertexCount;
+        size_t indexOffset, indexCount;
+        bool live;
+    };
+
+    // Which of the two buffers, for repack()
+    enum Part { VERTICES, INDICES };
+    // Allocate a range of the buffer, compacting or growing it if needed
+    size_t allocate(Part part, size_t size);
+    // Copy the live meshes' ranges of one buffer back to back into a
+    // new buffer of the given capacity, and update their offsets
+    void repack(Part part, size_t capacity);
+    // Write the vertices and indices to the staging buffer, which stays
+    // bound to GL_COPY_READ_BUFFER. Returns the offsets of both in it.
+    void stage(const void* vertices, size_t vertexBytes, const GLuint* indices, size_t indexBytes,
+               size_t& vertexOffset, size_t& indexOffset);
+
+    OpenGLContext* mp_context;
+    size_t m_vertexSize;
+    GLuint m_vertexBuffer;
+    GLuint m_indexBuffer;
+    GLuint m_vertexArray;
+    // Whether the buffers were replaced since the vertex array was set up
+    bool m_vertexArrayOutdated;
+    RangeAllocator m_vertexRanges;
+    RangeAllocator m_indexRanges;
+
+    std::vector<Mesh> m_meshes;
+    std::vector<Handle> m_freeHandles;
+    size_t m_liveMeshes;
+
+    // The staging buffer, written from m_stagingOffset on until it is full
+    GLuint m_stagingBuffer;
+    size_t m_stagingCapacity;
+    size_t m_stagingOffset;
+
+    uint64_t m_defragmentations;
+    uint64_t m_growths;
+    uint64_t m_stagingOrphans;
+};
+
+#endif // MESHARENA_H
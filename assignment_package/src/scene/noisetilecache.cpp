@@ -0,0 +1,139 @@
+#include "noisetilecache.h"
+#include "terrain.h"
+#include <algorithm>
+
+int NoiseTile::getHeight(int localX, int localZ) const {
+    return heights[localX + SIZE * localZ];
+}
+
+BiomeNoise::Biome NoiseTile::getBiome(int localX, int localZ) const {
+    return static_cast<BiomeNoise::Biome>(biomes[localX + SIZE * localZ]);
+}
+
+NoiseTileCache::NoiseTileCache(size_t capacity)
+    : m_capacity(std::max<size_t>(capacity, 1)), m_mutex(), m_lru(), m_tiles(),
+    m_hits(0), m_misses(0)
+{}
+
+sPtr<NoiseTile> NoiseTileCache::buildTile(int zoneX, int zoneZ) {
+    sPtr<NoiseTile> tile = mkS<NoiseTile>();
+    tile->zoneX = zoneX;
+    tile->zoneZ = zoneZ;
+
+    // Classify the biomes on the coarse biome grid only. The lattice includes
+    // the points on the far edges of the zone, which are shared with the
+    // neighboring zones, so that the blend is continuous across zone borders.
+    const int cells = NoiseTile::SIZE / BiomeNoise::BIOME_GRID;
+    const int gridX = zoneX * cells;
+    const int gridZ = zoneZ * cells;
+    std::array<float, (cells + 1) * (cells + 1)> weights;
+    for (int z = 0; z <= cells; ++z) {
+        for (int x = 0; x <= cells; ++x) {
+            weights[x + (cells + 1) * z] = BiomeNoise::getMountainWeight(gridX + x, gridZ + z);
+        }
+    }
+
+    for (int z = 0; z < NoiseTile::SIZE; ++z) {
+        int cellZ = z / BiomeNoise::BIOME_GRID;
+        float fz = (z % BiomeNoise::BIOME_GRID) / static_cast<float>(BiomeNoise::BIOME_GRID);
+        for (int x = 0; x < NoiseTile::SIZE; ++x) {
+            int cellX = x / BiomeNoise::BIOME_GRID;
+            float fx = (x % BiomeNoise::BIOME_GRID) / static_cast<float>(BiomeNoise::BIOME_GRID);
+
+            // Bilinear blend of the four surrounding grid weights
+            float w00 = weights[cellX + (cells + 1) * cellZ];
+            float w10 = weights[cellX + 1 + (cells + 1) * cellZ];
+            float w01 = weights[cellX + (cells + 1) * (cellZ + 1)];
+            float w11 = weights[cellX + 1 + (cells + 1) * (cellZ + 1)];
+            float w0 = w00 + fx * (w10 - w00);
+            float w1 = w01 + fx * (w11 - w01);
+            float weight = w0 + fz * (w1 - w0);
+
+            int worldX = zoneX * NoiseTile::SIZE + x;
+            int worldZ = zoneZ * NoiseTile::SIZE + z;
+            tile->heights[x + NoiseTile::SIZE * z] = static_cast<uint8_t>(BiomeNoise::getHeightForWeight(worldX, worldZ, weight));
+            tile->biomes[x + NoiseTile::SIZE * z] = static_cast<uint8_t>(BiomeNoise::getBiomeForWeight(weight));
+        }
+    }
+    return tile;
+}
+
+sPtr<const NoiseTile> NoiseTileCache::getTile(int zoneX, int zoneZ) {
+    int64_t key = toKey(zoneX, zoneZ);
+
+    m_mutex.lock();
+    auto it = m_tiles.find(key);
+    if (it != m_tiles.end()) {
+        // Move the zone to the front of the LRU list
+        m_lru.splice(m_lru.begin(), m_lru, it->second.lruPos);
+        sPtr<const NoiseTile> tile = it->second.tile;
+        m_mutex.unlock();
+        m_hits++;
+        return tile;
+    }
+    m_mutex.unlock();
+
+    m_misses++;
+    sPtr<const NoiseTile> tile = buildTile(zoneX, zoneZ);
+
+    m_mutex.lock();
+    // Another thread may have built the same tile in the meantime,
+    // since tiles are deterministic we simply keep the first one
+    it = m_tiles.find(key);
+    if (it != m_tiles.end()) {
+        tile = it->second.tile;
+    } else {
+        m_lru.push_front(key);
+        m_tiles[key] = Entry{tile, m_lru.begin()};
+        // Evict the least recently used tiles
+        while (m_tiles.size() > m_capacity) {
+            m_tiles.erase(m_lru.back());
+            m_lru.pop_back();
+        }
+    }
+    m_mutex.unlock();
+    return tile;
+}
+
+uint64_t NoiseTileCache::getHits() const {
+    return m_hits;
+}
+
+uint64_t NoiseTileCache::getMisses() const {
+    return m_misses;
+}
+
+float NoiseTileCache::getHitRate() const {
+    uint64_t hits = m_hits;
+    uint64_t total = hits + m_misses;
+    return total == 0 ? 0.f : static_cast<float>(hits) / static_cast<float>(total);
+}
+
+void NoiseTileCache::resetCounters() {
+    m_hits = 0;
+    m_misses = 0;
+}
+
+size_t NoiseTileCache::size() const {
+    m_mutex.lock();
+    size_t s = m_tiles.size();
+    m_mutex.unlock();
+    return s;
+}
+
+size_t NoiseTileCache::capacity() const {
+    m_mutex.lock();
+    size_t c = m_capacity;
+    m_mutex.unlock();
+    return c;
+}
+
+void NoiseTileCache::setCapacity(size_t capacity) {
+    m_mutex.lock();
+    m_capacity = std::max<size_t>(capacity, 1);
+    while (m_tiles.size() > m_capacity) {
+        m_tiles.erase(m_lru.back());
+        m_lru.pop_back();
+    }
+    m_mutex.unlock();
+}
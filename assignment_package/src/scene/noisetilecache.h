@@ -0,0 +1,73 @@
+#ifndef NOISETILECACHE_H
+#define NOISETILECACHE_H
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <unordered_map>
+#include <QMutex>
+#include "../smartpointerhelp.h"
+#include "biomenoise.h"
+
+// The precomputed column data (surface height and biome) of one
+// 64 x 64 terrain generation zone. Every Chunk, save and reload
+// inside the zone reads from the same tile instead of resampling
+// the biome noise for each column on its own.
+struct NoiseTile {
+    static const int SIZE = 64;
+
+    int zoneX, zoneZ;
+    // Heights are clamped to [0, 255] by BiomeNoise, so one byte each is enough
+    std::array<uint8_t, SIZE * SIZE> heights;
+    std::array<uint8_t, SIZE * SIZE> biomes;
+
+    // Coordinates are local to the zone, i.e. in [0, 64)
+    int getHeight(int localX, int localZ) const;
+    BiomeNoise::Biome getBiome(int localX, int localZ) const;
+};
+
+// A bounded, thread-safe LRU cache of NoiseTiles keyed by the same
+// zone key that Terrain uses (toKey(zoneX, zoneZ)).
+// Tiles are handed out as shared pointers, so a tile that gets evicted
+// while a worker is still reading it stays alive until the worker is done.
+class NoiseTileCache {
+public:
+    NoiseTileCache(size_t capacity = 64);
+
+    // Get the tile of the given zone, building it if it isn't cached yet
+    sPtr<const NoiseTile> getTile(int zoneX, int zoneZ);
+
+    // --- Statistics ---
+    uint64_t getHits() const;
+    uint64_t getMisses() const;
+    // Fraction of lookups that were served from the cache (0 if there were none)
+    float getHitRate() const;
+    void resetCounters();
+    size_t size() const;
+    size_t capacity() const;
+    // Change the number of cached tiles, evicting tiles if there are too many
+    void setCapacity(size_t capacity);
+
+private:
+    // Sample the noise for every column of the zone
+    static sPtr<NoiseTile> buildTile(int zoneX, int zoneZ);
+
+    size_t m_capacity;
+
+    // Protects m_capacity, m_lru and m_tiles. Tiles are built outside of the lock
+    // so that workers generating different zones don't serialize.
+    mutable QMutex m_mutex;
+    // Zone keys ordered from most to least recently used
+    std::list<int64_t> m_lru;
+    struct Entry {
+        sPtr<const NoiseTile> tile;
+        std::list<int64_t>::iterator lruPos;
+    };
+    std::unordered_map<int64_t, Entry> m_tiles;
+
+    std::atomic<uint64_t> m_hits;
+    std::atomic<uint64_t> m_misses;
+};
+
+#endif // NOISETILECACHE_H
@@ -0,0 +1,80 @@
+#include "overdrawmeter.h"
+
+OverdrawMeter::OverdrawMeter(OpenGLContext* context)
+    : mp_context(context), m_queries(), m_pixels(), m_pending(), m_next(0), m_active(false),
+    m_samples(0), m_totalPixels(0), m_frames(0)
+{
+    m_queries.fill(0);
+    m_pixels.fill(0);
+    m_pending.fill(false);
+}
+
+OverdrawMeter::~OverdrawMeter() {
+    destroy();
+}
+
+void OverdrawMeter::begin() {
+    if (m_queries[0] == 0) {
+        mp_context->glGenQueries(QUERY_COUNT, m_queries.data());
+    }
+    // The query issued QUERY_COUNT frames ago is normally done by now
+    if (m_pending[m_next] && !collect(m_next)) {
+        return;
+    }
+    GLint viewport[4];
+    mp_context->glGetIntegerv(GL_VIEWPORT, viewport);
+    m_pixels[m_next] = static_cast<uint64_t>(viewport[2]) * static_cast<uint64_t>(viewport[3]);
+    mp_context->glBeginQuery(GL_SAMPLES_PASSED, m_queries[m_next]);
+    m_active = true;
+}
+
+void OverdrawMeter::end() {
+    if (!m_active) {
+        return;
+    }
+    mp_context->glEndQuery(GL_SAMPLES_PASSED);
+    m_active = false;
+    m_pending[m_next] = true;
+    m_next = (m_next + 1) % QUERY_COUNT;
+}
+
+bool OverdrawMeter::collect(int slot) {
+    GLuint available = 0;
+    mp_context->glGetQueryObjectuiv(m_queries[slot], GL_QUERY_RESULT_AVAILABLE, &available);
+    if (!available) {
+        return false;
+    }
+    GLuint samples = 0;
+    mp_context->glGetQueryObjectuiv(m_queries[slot], GL_QUERY_RESULT, &samples);
+    m_pending[slot] = false;
+    m_samples += samples;
+    m_totalPixels += m_pixels[slot];
+    m_frames++;
+    return true;
+}
+
+void OverdrawMeter::reset() {
+    // Queries still in flight measured the previous setup, their results are
+    // dropped. Issuing a query again simply replaces its result.
+    m_pending.fill(false);
+    m_samples = 0;
+    m_totalPixels = 0;
+    m_frames = 0;
+}
+
+void OverdrawMeter::destroy() {
+    if (m_queries[0] != 0) {
+        mp_context->glDeleteQueries(QUERY_COUNT, m_queries.data());
+        m_queries.fill(0);
+    }
+    m_pending.fill(false);
+    m_active = false;
+}
+
+double OverdrawMeter::getFragmentsPerPixel() const {
+    return m_totalPixels == 0 ? 0.0 : static_cast<double>(m_samples) / m_totalPixels;
+}
+
+uint64_t OverdrawMeter::getMeasuredFrames() const {
+    return m_frames;
+}
@@ -0,0 +1,55 @@
+#ifndef OVERDRAWMETER_H
+#define OVERDRAWMETER_H
+
+#include <array>
+#include <cstdint>
+#include "../openglcontext.h"
+
+// Measures how many fragments the draws between begin() and end() shade
+// per pixel of the viewport, with GL_SAMPLES_PASSED occlusion queries.
+// 1 means every pixel was shaded once, anything above is overdraw.
+//
+// The results are read a few frames later, from a ring of queries, so
+// measuring never waits for the GPU. A frame whose query slot is still
+// in flight is skipped. All functions have to be called with the OpenGL
+// context current.
+class OverdrawMeter {
+public:
+    OverdrawMeter(OpenGLContext* context);
+    ~OverdrawMeter();
+    OverdrawMeter(const OverdrawMeter&) = delete;
+    OverdrawMeter& operator=(const OverdrawMeter&) = delete;
+
+    // Count the samples of the draws that follow, until end()
+    void begin();
+    void end();
+    // Forget the results so far, e.g. after the draw order changed
+    void reset();
+    // Delete the queries
+    void destroy();
+
+    // Fragments that passed the depth test per viewport pixel,
+    // averaged over the frames measured since the last reset
+    double getFragmentsPerPixel() const;
+    uint64_t getMeasuredFrames() const;
+
+private:
+    static const int QUERY_COUNT = 4;
+    // Add the result of the query in the slot, returns false if it isn't ready
+    bool collect(int slot);
+
+    OpenGLContext* mp_context;
+    std::array<GLuint, QUERY_COUNT> m_queries;
+    // The viewport size when each query was issued, and whether it's waiting to be read
+    std::array<uint64_t, QUERY_COUNT> m_pixels;
+    std::array<bool, QUERY_COUNT> m_pending;
+    int m_next;
+    // Whether begin() started a query
+    bool m_active;
+
+    uint64_t m_samples;
+    uint64_t m_totalPixels;
+    uint64_t m_frames;
+};
+
+#endif // OVERDRAWMETER_H
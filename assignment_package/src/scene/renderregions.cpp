@@ -0,0 +1,199 @@
+#include "renderregions.h"
+#include "chunk.h"
+#include <algorithm>
+#include <cmath>
+
+// Size of a region along x and z, in blocks (one zone, 1 << 6)
+const static int REGION_SIZE = 64;
+// A chunk only switches to a coarser level of detail this many blocks
+// past the threshold, and back to a finer one this many blocks before it,
+// so walking back and forth across a threshold doesn't remesh it every time
+const static float LOD_HYSTERESIS = 8.f;
+
+enum Containment { OUTSIDE, INTERSECTING, INSIDE };
+
+// Where the box lies relative to the frustum, using the corners
+// furthest along and furthest against each plane's normal
+static Containment classifyBox(const std::array<glm::vec4, 6>& planes,
+                               const glm::vec3& minCorner, const glm::vec3& maxCorner) {
+    Containment result = INSIDE;
+    for (const glm::vec4& plane : planes) {
+        glm::vec3 positive(plane.x >= 0.f ? maxCorner.x : minCorner.x,
+                           plane.y >= 0.f ? maxCorner.y : minCorner.y,
+                           plane.z >= 0.f ? maxCorner.z : minCorner.z);
+        if (glm::dot(plane, glm::vec4(positive, 1.f)) < 0.f) {
+            return OUTSIDE;
+        }
+        glm::vec3 negative(plane.x >= 0.f ? minCorner.x : maxCorner.x,
+                           plane.y >= 0.f ? minCorner.y : maxCorner.y,
+                           plane.z >= 0.f ? minCorner.z : maxCorner.z);
+        if (glm::dot(plane, glm::vec4(negative, 1.f)) < 0.f) {
+            result = INTERSECTING;
+        }
+    }
+    return result;
+}
+
+RenderRegions::RenderRegions()
+    : m_grid(), m_radius(-1), m_occupied(), m_chunks(), m_chunkRegions(), m_boxes(),
+    m_inView(), m_visible(), m_heightsChanged(false),
+    m_rebuilds(0), m_regionsCulled(0), m_regionsInside(0), m_chunksTested(0)
+{}
+
+void RenderRegions::rebuild(const std::vector<Chunk*>& chunks, glm::vec2 playerXZ,
+                            float viewDistance, float lod1Distance, float lod2Distance) {
+    m_rebuilds++;
+    m_occupied.clear();
+    m_chunks.clear();
+    m_chunkRegions.clear();
+    m_visible.clear();
+    m_heightsChanged = false;
+
+    // Enough regions to cover the view distance around the player's zone
+    glm::ivec2 centerZone(static_cast<int>(std::floor(playerXZ.x / REGION_SIZE)),
+                          static_cast<int>(std::floor(playerXZ.y / REGION_SIZE)));
+    int radius = static_cast<int>(std::ceil(viewDistance / REGION_SIZE)) + 1;
+    int width = 2 * radius + 1;
+    if (radius != m_radius) {
+        m_grid.resize(static_cast<size_t>(width * width));
+        m_radius = radius;
+    }
+    for (int z = 0; z < width; ++z) {
+        for (int x = 0; x < width; ++x) {
+            Region& region = m_grid[x + width * z];
+            // The heights start out empty and grow with the region's chunks
+            float minX = static_cast<float>((centerZone.x + x - radius) * REGION_SIZE);
+            float minZ = static_cast<float>((centerZone.y + z - radius) * REGION_SIZE);
+            region.minCorner = glm::vec3(minX, 256.f, minZ);
+            region.maxCorner = glm::vec3(minX + REGION_SIZE, 0.f, minZ + REGION_SIZE);
+            // Counts the region's chunks until the ranges are assigned below
+            region.begin = 0;
+            region.end = 0;
+        }
+    }
+
+    const float viewDistance2 = viewDistance * viewDistance;
+    const std::array<float, 2> lodDistances = {lod1Distance, lod2Distance};
+    for (Chunk* chunk : chunks) {
+        glm::vec2 offset = chunk->getCenter() - playerXZ;
+        float distance2 = glm::dot(offset, offset);
+        if (distance2 >= viewDistance2) {
+            continue;
+        }
+        glm::ivec2 corner = chunk->getCorner();
+        int x = (corner.x >> 6) - centerZone.x + radius;
+        int z = (corner.y >> 6) - centerZone.y + radius;
+        if (x < 0 || x >= width || z < 0 || z >= width) {
+            continue;
+        }
+
+        // The band around each threshold keeps the current level of detail
+        float distance = std::sqrt(distance2);
+        int currentLevel = chunk->getLevelOfDetail();
+        int lodLevel = 0;
+        for (int level = 0; level < static_cast<int>(lodDistances.size()); ++level) {
+            float threshold = lodDistances[level] + (currentLevel > level ? -LOD_HYSTERESIS : LOD_HYSTERESIS);
+            if (distance > threshold) {
+                lodLevel = level + 1;
+            }
+        }
+        chunk->setLevelOfDetail(lodLevel);
+
+        size_t index = static_cast<size_t>(x + width * z);
+        if (m_grid[index].end++ == 0) {
+            m_occupied.push_back(index);
+        }
+        m_chunks.push_back(chunk);
+        m_chunkRegions.push_back(index);
+    }
+
+    // Sort the chunks by region (a counting sort, the counts are in end)
+    size_t offset = 0;
+    for (size_t index : m_occupied) {
+        Region& region = m_grid[index];
+        region.begin = offset;
+        offset += region.end;
+        region.end = region.begin;
+    }
+    std::vector<Chunk*> unsorted;
+    unsorted.swap(m_chunks);
+    m_chunks.resize(unsorted.size());
+    for (size_t i = 0; i < unsorted.size(); ++i) {
+        m_chunks[m_grid[m_chunkRegions[i]].end++] = unsorted[i];
+    }
+    for (size_t index : m_occupied) {
+        const Region& region = m_grid[index];
+        std::fill(m_chunkRegions.begin() + region.begin, m_chunkRegions.begin() + region.end, index);
+    }
+
+    m_boxes.clear();
+    m_boxes.reserve(m_chunks.size());
+    for (Chunk* chunk : m_chunks) {
+        glm::ivec2 corner = chunk->getCorner();
+        m_boxes.add(glm::vec3(corner.x, 0.f, corner.y), glm::vec3(corner.x + 16, 0.f, corner.y + 16));
+    }
+    for (size_t i = 0; i < m_chunks.size(); ++i) {
+        refreshHeightRange(i);
+    }
+    m_inView.resize(m_chunks.size());
+}
+
+void RenderRegions::refreshHeightRanges() {
+    m_heightsChanged = true;
+}
+
+void RenderRegions::refreshHeightRange(size_t index) {
+    glm::ivec2 heights = m_chunks[index]->getHeightRange();
+    m_boxes.setHeightRange(index, static_cast<float>(heights.x), static_cast<float>(heights.y));
+    // Regions only grow until the next rebuild
+    Region& region = m_grid[m_chunkRegions[index]];
+    region.minCorner.y = std::min(region.minCorner.y, static_cast<float>(heights.x));
+    region.maxCorner.y = std::max(region.maxCorner.y, static_cast<float>(heights.y));
+}
+
+void RenderRegions::collectVisible(const std::array<glm::vec4, 6>& frustumPlanes, std::vector<Chunk*>& visible) {
+    // Meshes were uploaded for the chunks drawn last frame,
+    // and blocks changed anywhere if the heights changed
+    if (m_heightsChanged) {
+        for (size_t i = 0; i < m_chunks.size(); ++i) {
+            refreshHeightRange(i);
+        }
+        m_heightsChanged = false;
+    } else {
+        for (size_t i : m_visible) {
+            refreshHeightRange(i);
+        }
+    }
+    m_visible.clear();
+
+    m_regionsCulled = 0;
+    m_regionsInside = 0;
+    m_chunksTested = 0;
+    for (size_t index : m_occupied) {
+        const Region& region = m_grid[index];
+        Containment containment = classifyBox(frustumPlanes, region.minCorner, region.maxCorner);
+        if (containment == OUTSIDE) {
+            m_regionsCulled++;
+            continue;
+        }
+        if (containment == INSIDE) {
+            m_regionsInside++;
+            std::fill(m_inView.begin() + region.begin, m_inView.begin() + region.end, 1);
+        } else {
+            m_boxes.cull(frustumPlanes, region.begin, region.end, m_inView.data() + region.begin);
+            m_chunksTested += region.end - region.begin;
+        }
+        for (size_t i = region.begin; i < region.end; ++i) {
+            // Chunks still generating are skipped until their blocks are in
+            if (m_inView[i] && m_chunks[i]->hasBlockData()) {
+                visible.push_back(m_chunks[i]);
+                m_visible.push_back(i);
+            }
+        }
+    }
+}
+
+RenderRegions::Stats RenderRegions::getStats() const {
+    return Stats{m_occupied.size(), m_chunks.size(), m_rebuilds,
+                 m_regionsCulled, m_regionsInside, m_chunksTested};
+}
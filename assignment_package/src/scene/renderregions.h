@@ -0,0 +1,91 @@
+#ifndef RENDERREGIONS_H
+#define RENDERREGIONS_H
+
+#include <array>
+#include <cstdint>
+#include <vector>
+#include "../glm_includes.h"
+#include "cullingboxes.h"
+
+class Chunk;
+
+// The chunks within the view distance of the player, bucketed into a
+// dense 2D grid of render regions (one per 64 x 64 zone) around the
+// player's zone.
+//
+// Which chunks are in range, and the level of detail of each of them,
+// only change when the player enters another chunk, the view distance
+// changes or chunks are loaded or unloaded. rebuild() recomputes them
+// then. Every frame, collectVisible() tests whole regions against the
+// view frustum and only tests the chunks of regions that straddle one
+// of its planes, so the per-frame cost depends on the regions around
+// the player and not on every loaded chunk.
+//
+// The chunks are stored region by region, with their bounding boxes in
+// a CullingBoxes, so the chunks of a region are culled as one batch.
+// The boxes only span the heights the chunks' meshes cover.
+class RenderRegions {
+public:
+    struct Stats {
+        size_t regions;         // Regions holding chunks in range
+        size_t chunks;          // Chunks in range
+        uint64_t rebuilds;
+        // Of the last collectVisible()
+        size_t regionsCulled;   // Entirely outside of the frustum
+        size_t regionsInside;   // Entirely inside, their chunks weren't tested
+        size_t chunksTested;
+    };
+
+    RenderRegions();
+
+    // Bucket the chunks within viewDistance of the player into regions and
+    // set their level of detail: 0 up to lod1Distance, 1 up to lod2Distance,
+    // 2 beyond. Chunks within a few blocks of a threshold keep their
+    // current level of detail.
+    void rebuild(const std::vector<Chunk*>& chunks, glm::vec2 playerXZ,
+                 float viewDistance, float lod1Distance, float lod2Distance);
+
+    // Append the chunks in range that have block data and intersect
+    // the frustum (planes as returned by Camera::getFrustumPlanes)
+    void collectVisible(const std::array<glm::vec4, 6>& frustumPlanes, std::vector<Chunk*>& visible);
+    // Re-read the height ranges of all chunks in range on the next
+    // collectVisible(), after blocks were changed. (The chunks that were
+    // visible are re-read every frame, they are the ones being uploaded.)
+    void refreshHeightRanges();
+
+    Stats getStats() const;
+
+private:
+    struct Region {
+        glm::vec3 minCorner, maxCorner;
+        // The region's chunks are m_chunks[begin, end)
+        size_t begin, end;
+    };
+    // Re-read the height range of the chunk at this index
+    void refreshHeightRange(size_t index);
+
+    // Regions of the zones within m_radius of the player's zone at the
+    // last rebuild, zone offset (x, z) at index (x + radius) + width * (z + radius)
+    std::vector<Region> m_grid;
+    int m_radius;
+    // Indices of the regions that hold chunks
+    std::vector<size_t> m_occupied;
+
+    // The chunks in range ordered by region, the region of each of them,
+    // and their bounding boxes
+    std::vector<Chunk*> m_chunks;
+    std::vector<size_t> m_chunkRegions;
+    CullingBoxes m_boxes;
+    // Per-chunk results of the last cull
+    std::vector<uint8_t> m_inView;
+    // Indices of the chunks collectVisible() returned last
+    std::vector<size_t> m_visible;
+    bool m_heightsChanged;
+
+    uint64_t m_rebuilds;
+    size_t m_regionsCulled;
+    size_t m_regionsInside;
+    size_t m_chunksTested;
+};
+
+#endif // RENDERREGIONS_H
@@ -0,0 +1,67 @@
+#include "riverregistry.h"
+
+RiverRegistry::RiverRegistry()
+    : m_head(nullptr), m_buckets(), m_size(0)
+{
+    for (std::atomic<const ZoneNode*>& bucket : m_buckets) {
+        bucket.store(nullptr, std::memory_order_relaxed);
+    }
+}
+
+RiverRegistry::~RiverRegistry() {
+    for (std::atomic<const ZoneNode*>& bucket : m_buckets) {
+        const ZoneNode* node = bucket.load(std::memory_order_acquire);
+        while (node) {
+            const ZoneNode* next = node->next;
+            delete node;
+            node = next;
+        }
+    }
+    const Node* node = m_head.load(std::memory_order_acquire);
+    while (node) {
+        const Node* next = node->next;
+        delete node;
+        node = next;
+    }
+}
+
+size_t RiverRegistry::bucketIndex(int zoneX, int zoneZ) {
+    uint32_t hash = static_cast<uint32_t>(zoneX) * 73856093u ^ static_cast<uint32_t>(zoneZ) * 19349663u;
+    return hash % BUCKET_COUNT;
+}
+
+void RiverRegistry::add(Rivers&& river) {
+    Node* node = new Node{std::move(river), m_head.load(std::memory_order_relaxed)};
+    // The release makes the fully constructed river visible
+    // to every reader that acquires the new head
+    while (!m_head.compare_exchange_weak(node->next, node,
+                                         std::memory_order_release,
+                                         std::memory_order_relaxed)) {}
+    m_size++;
+
+    const Rivers& r = node->river;
+    if (r.empty()) {
+        return;
+    }
+    // Floor division, the arithmetic shift rounds negative coordinates down
+    static_assert(ZONE_SIZE == 64, "zones are found with a shift by 6");
+    for (int zoneX = r.getMinX() >> 6; zoneX <= r.getMaxX() >> 6; ++zoneX) {
+        for (int zoneZ = r.getMinZ() >> 6; zoneZ <= r.getMaxZ() >> 6; ++zoneZ) {
+            std::atomic<const ZoneNode*>& bucket = m_buckets[bucketIndex(zoneX, zoneZ)];
+            ZoneNode* zoneNode = new ZoneNode{zoneX, zoneZ, &r, bucket.load(std::memory_order_relaxed)};
+            while (!bucket.compare_exchange_weak(zoneNode->next, zoneNode,
+                                                 std::memory_order_release,
+                                                 std::memory_order_relaxed)) {}
+        }
+    }
+}
+
+RiverRegistry::Snapshot RiverRegistry::snapshot(int x, int z) const {
+    int zoneX = x >> 6;
+    int zoneZ = z >> 6;
+    return Snapshot(m_buckets[bucketIndex(zoneX, zoneZ)].load(std::memory_order_acquire), zoneX, zoneZ);
+}
+
+size_t RiverRegistry::size() const {
+    return m_size;
+}
@@ -0,0 +1,107 @@
+#ifndef RIVERREGISTRY_H
+#define RIVERREGISTRY_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <iterator>
+#include "rivers.h"
+
+// Append-only collection of all rivers in the world that can be read by
+// generation workers while the main thread keeps adding rivers.
+//
+// The rivers form an immutable singly linked list, newest first. Adding a
+// river publishes a new head with a single atomic pointer swap, and the
+// nodes behind a head never change, so any head a reader loaded stays a
+// consistent snapshot for as long as the reader wants. Nodes are only
+// freed with the registry itself, after all workers are done.
+//
+// Readers only ever need the rivers around one chunk, so every river is
+// also linked into one list per zone (64 x 64 blocks) its cells overlap.
+// The zone lists hang off a fixed table of buckets, hashed by zone, and
+// are published the same way as the list of all rivers.
+class RiverRegistry {
+private:
+    struct Node {
+        Rivers river;
+        const Node* next;
+    };
+    // A river in the list of one zone. Zones that hash to
+    // the same bucket share a list, and are told apart by zoneX, zoneZ.
+    struct ZoneNode {
+        int zoneX;
+        int zoneZ;
+        const Rivers* river;
+        const ZoneNode* next;
+    };
+
+public:
+    // A consistent view of the rivers overlapping one zone
+    // that existed when it was taken
+    class Snapshot {
+    public:
+        class Iterator {
+        public:
+            using iterator_category = std::forward_iterator_tag;
+            using value_type = Rivers;
+            using difference_type = std::ptrdiff_t;
+            using pointer = const Rivers*;
+            using reference = const Rivers&;
+
+            Iterator(const ZoneNode* node, int zoneX, int zoneZ)
+                : mp_node(node), m_zoneX(zoneX), m_zoneZ(zoneZ) { skipOtherZones(); }
+            reference operator*() const { return *mp_node->river; }
+            pointer operator->() const { return mp_node->river; }
+            Iterator& operator++() { mp_node = mp_node->next; skipOtherZones(); return *this; }
+            bool operator==(const Iterator& other) const { return mp_node == other.mp_node; }
+            bool operator!=(const Iterator& other) const { return mp_node != other.mp_node; }
+
+        private:
+            void skipOtherZones() {
+                while (mp_node && (mp_node->zoneX != m_zoneX || mp_node->zoneZ != m_zoneZ)) {
+                    mp_node = mp_node->next;
+                }
+            }
+            const ZoneNode* mp_node;
+            int m_zoneX, m_zoneZ;
+        };
+
+        Iterator begin() const { return Iterator(mp_head, m_zoneX, m_zoneZ); }
+        Iterator end() const { return Iterator(nullptr, m_zoneX, m_zoneZ); }
+        bool empty() const { return begin() == end(); }
+
+    private:
+        friend class RiverRegistry;
+        Snapshot(const ZoneNode* head, int zoneX, int zoneZ)
+            : mp_head(head), m_zoneX(zoneX), m_zoneZ(zoneZ) {}
+        const ZoneNode* mp_head;
+        int m_zoneX, m_zoneZ;
+    };
+
+    static const int ZONE_SIZE = 64;
+
+    RiverRegistry();
+    ~RiverRegistry();
+    RiverRegistry(const RiverRegistry&) = delete;
+    RiverRegistry& operator=(const RiverRegistry&) = delete;
+
+    // Publish a new river. Safe to call from any thread,
+    // never blocks readers.
+    void add(Rivers&& river);
+
+    // The rivers with cells in the zone that contains the block x, z.
+    // Wait-free, never blocks or is blocked by add()
+    Snapshot snapshot(int x, int z) const;
+
+    size_t size() const;
+
+private:
+    static const size_t BUCKET_COUNT = 1024;
+    static size_t bucketIndex(int zoneX, int zoneZ);
+
+    std::atomic<const Node*> m_head;
+    std::array<std::atomic<const ZoneNode*>, BUCKET_COUNT> m_buckets;
+    std::atomic<size_t> m_size;
+};
+
+#endif // RIVERREGISTRY_H
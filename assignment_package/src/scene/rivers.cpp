@@ -1,6 +1,7 @@
 #include "rivers.h"
-#include <stack>
 #include <cmath>
+#include <algorithm>
+#include <limits>
 #include <glm/glm.hpp>
 #include <glm/gtc/constants.hpp>
 #include <glm/gtc/type_ptr.hpp>
@@ -17,13 +18,16 @@ Rivers::Rivers(const std::string &axiom,
                double angleDegrees,
                double stepSize,
                double startX,
-               double startZ)
+               double startZ,
+               int minX, int minZ, int maxX, int maxZ)
     : m_axiom(axiom), m_rules(rules), m_iterations(iterations),
     m_angleDegrees(angleDegrees), m_stepSize(stepSize),
-    m_startX(startX), m_startZ(startZ)
+    m_startX(startX), m_startZ(startZ),
+    m_clipMinX(minX), m_clipMinZ(minZ), m_clipMaxX(maxX), m_clipMaxZ(maxZ),
+    m_minX(0), m_minZ(0), m_maxX(-1), m_maxZ(-1)
 {
-    m_systemString = generateSystem();
     computeRiverPositions();
+    computeBounds();
 }
 
 std::string Rivers::generateSystem() const {
@@ -50,43 +54,46 @@ void Rivers::computeRiverPositions() {
     std::stack<TurtleState> stateStack;
     TurtleState currentState{m_startX, m_startZ, 0.0};
 
-    double angleDelta = m_angleDegrees;
+    m_riverPositions.clear();
+    if (m_clipMinX > m_clipMaxX || m_clipMinZ > m_clipMaxZ) {
+        return;
+    }
+    size_t cells = static_cast<size_t>(m_clipMaxX - m_clipMinX + 1) * (m_clipMaxZ - m_clipMinZ + 1);
+    m_visited.assign((cells + 63) / 64, 0);
+    interpret(m_axiom, m_iterations, currentState, stateStack);
+    std::vector<uint64_t>().swap(m_visited);
 
-    for (char c : m_systemString) {
-        switch (c) {
-        case 'F': {
-            double radians = glm::radians(currentState.angle);
-            double dx = std::cos(radians);
-            double dz = std::sin(radians);
-
-            int steps = (int)std::round(m_stepSize);
-            double cx = currentState.x;
-            double cz = currentState.z;
-
-            for (int i = 0; i < steps; i++) {
-                cx += dx;
-                cz += dz;
-                int ix = (int)std::round(cx);
-                int iz = (int)std::round(cz);
-                m_riverPositions.insert(toKey(ix, iz));
-            }
+    std::sort(m_riverPositions.begin(), m_riverPositions.end());
+    m_riverPositions.shrink_to_fit();
+}
 
-            currentState.x = cx;
-            currentState.z = cz;
+void Rivers::interpret(const std::string& str, int depth,
+                       TurtleState& state, std::stack<TurtleState>& stateStack) {
+    for (char c : str) {
+        if (depth > 0) {
+            auto rule = m_rules.find(c);
+            if (rule != m_rules.end()) {
+                interpret(rule->second, depth - 1, state, stateStack);
+                continue;
+            }
         }
-        break;
+
+        switch (c) {
+        case 'F':
+            moveForward(state);
+            break;
         case '+':
-            currentState.angle += angleDelta;
+            state.angle += m_angleDegrees;
             break;
         case '-':
-            currentState.angle -= angleDelta;
+            state.angle -= m_angleDegrees;
             break;
         case '[':
-            stateStack.push(currentState);
+            stateStack.push(state);
             break;
         case ']':
             if (!stateStack.empty()) {
-                currentState = stateStack.top();
+                state = stateStack.top();
                 stateStack.pop();
             }
             break;
@@ -96,6 +103,74 @@ void Rivers::computeRiverPositions() {
     }
 }
 
+void Rivers::moveForward(TurtleState& state) {
+    double radians = glm::radians(state.angle);
+    double dx = std::cos(radians);
+    double dz = std::sin(radians);
+
+    int steps = (int)std::round(m_stepSize);
+    double cx = state.x;
+    double cz = state.z;
+
+    for (int i = 0; i < steps; i++) {
+        cx += dx;
+        cz += dz;
+        int ix = (int)std::round(cx);
+        int iz = (int)std::round(cz);
+        if (ix < m_clipMinX || ix > m_clipMaxX || iz < m_clipMinZ || iz > m_clipMaxZ) {
+            continue;
+        }
+        size_t bit = static_cast<size_t>(ix - m_clipMinX) * (m_clipMaxZ - m_clipMinZ + 1)
+                     + static_cast<size_t>(iz - m_clipMinZ);
+        uint64_t mask = uint64_t(1) << (bit & 63);
+        if (m_visited[bit >> 6] & mask) {
+            continue;
+        }
+        m_visited[bit >> 6] |= mask;
+        m_riverPositions.push_back(toKey(ix, iz));
+    }
+
+    state.x = cx;
+    state.z = cz;
+}
+
 bool Rivers::isRiverAt(int x, int z) const {
-    return m_riverPositions.find(toKey(x, z)) != m_riverPositions.end();
+    return std::binary_search(m_riverPositions.begin(), m_riverPositions.end(), toKey(x, z));
+}
+
+void Rivers::computeBounds() {
+    m_minX = m_minZ = std::numeric_limits<int>::max();
+    m_maxX = m_maxZ = std::numeric_limits<int>::min();
+    for (int64_t key : m_riverPositions) {
+        int x = static_cast<int>(key >> 32);
+        int z = static_cast<int>(static_cast<int32_t>(key & 0xffffffff));
+        m_minX = std::min(m_minX, x);
+        m_minZ = std::min(m_minZ, z);
+        m_maxX = std::max(m_maxX, x);
+        m_maxZ = std::max(m_maxZ, z);
+    }
+}
+
+bool Rivers::overlaps(int minX, int minZ, int maxX, int maxZ) const {
+    return m_minX <= maxX && m_maxX >= minX && m_minZ <= maxZ && m_maxZ >= minZ;
+}
+
+bool Rivers::empty() const {
+    return m_riverPositions.empty();
+}
+
+int Rivers::getMinX() const {
+    return m_minX;
+}
+
+int Rivers::getMinZ() const {
+    return m_minZ;
+}
+
+int Rivers::getMaxX() const {
+    return m_maxX;
+}
+
+int Rivers::getMaxZ() const {
+    return m_maxZ;
 }
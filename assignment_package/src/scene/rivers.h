@@ -3,7 +3,8 @@
 
 #include <string>
 #include <unordered_map>
-#include <unordered_set>
+#include <vector>
+#include <stack>
 #include <cstdint>
 
 struct TurtleState {
@@ -20,14 +21,30 @@ public:
            double angleDegrees,
            double stepSize,
            double startX,
-           double startZ);
+           double startZ,
+           // Only the cells in [minX, maxX] x [minZ, maxZ] are kept
+           int minX, int minZ, int maxX, int maxZ);
 
+    // Fully expanded L-system string. Only useful for debugging,
+    // computeRiverPositions streams the expansion instead of building it.
     std::string generateSystem() const;
 
     void computeRiverPositions();
 
     bool isRiverAt(int x, int z) const;
 
+    // Does the bounding box of the river cells intersect
+    // [minX, maxX] x [minZ, maxZ]?
+    bool overlaps(int minX, int minZ, int maxX, int maxZ) const;
+
+    // Whether the river has no cells, e.g. it's entirely clipped
+    bool empty() const;
+    // Bounding box of the river cells, only valid if it isn't empty
+    int getMinX() const;
+    int getMinZ() const;
+    int getMaxX() const;
+    int getMaxZ() const;
+
 private:
     std::string m_axiom;
     std::unordered_map<char, std::string> m_rules;
@@ -36,9 +53,26 @@ private:
     double m_stepSize;
     double m_startX;
     double m_startZ;
+    int m_clipMinX, m_clipMinZ, m_clipMaxX, m_clipMaxZ;
+
+    // Sorted, duplicate free keys of all river cells.
+    // 8 bytes per cell instead of a hash set node each.
+    std::vector<int64_t> m_riverPositions;
+    // Bounding box of m_riverPositions (empty if min > max)
+    int m_minX, m_minZ, m_maxX, m_maxZ;
+    void computeBounds();
 
-    std::string m_systemString;
-    std::unordered_set<int64_t> m_riverPositions;
+    // Interpret the symbols of str, rewriting each symbol that has a rule
+    // depth more times, depth first. Equivalent to interpreting the
+    // expanded string, but only needs memory proportional to the depth.
+    void interpret(const std::string& str, int depth,
+                   TurtleState& state, std::stack<TurtleState>& stateStack);
+    void moveForward(TurtleState& state);
+    // One bit per cell of the clip box, set once the cell is in
+    // m_riverPositions. Branches retrace the same cells over and over,
+    // this keeps each cell from being stored more than once.
+    // Only allocated during computeRiverPositions.
+    std::vector<uint64_t> m_visited;
 
     int64_t toKey(int x, int z) const;
 };
@@ -1,11 +1,17 @@
 #include "saveloadworker.h"
 
-SaveLoadWorker::SaveLoadWorker(Terrain* terrain, int zoneX, int zoneZ, bool save) : m_terrain(terrain), m_zoneX(zoneX), m_zoneZ(zoneZ), m_save(save) {}
+SaveLoadWorker::SaveLoadWorker(Terrain* terrain, int zoneX, int zoneZ, bool save) : m_terrain(terrain), m_zoneX(zoneX), m_zoneZ(zoneZ), m_save(save), m_chunks() {}
+
+SaveLoadWorker::SaveLoadWorker(Terrain* terrain, int zoneX, int zoneZ, std::vector<Chunk*> chunks) : m_terrain(terrain), m_zoneX(zoneX), m_zoneZ(zoneZ), m_save(true), m_chunks(std::move(chunks)) {}
 
 void SaveLoadWorker::run() {
-    if (m_save) {
+    if (!m_chunks.empty()) {
+        m_terrain->writeZone(m_zoneX, m_zoneZ, m_chunks);
+    } else if (m_save) {
         m_terrain->saveZone(m_zoneX, m_zoneZ);
     } else {
         m_terrain->loadZone(m_zoneX, m_zoneZ);
     }
-}
\ No newline at end of file
+    // Let the terrain load or unload the zone again
+    m_terrain->releaseZone(m_zoneX, m_zoneZ);
+}
@@ -2,6 +2,7 @@
 #define SAVELOADWORKER_H
 
 #include <QRunnable>
+#include <vector>
 #include "terrain.h"
 
 class Terrain;
@@ -12,8 +13,12 @@ private:
     int m_zoneX;
     int m_zoneZ;
     bool m_save;
+    // The chunks of a zone that was unloaded, which aren't in the Terrain anymore
+    std::vector<Chunk*> m_chunks;
 public:
     SaveLoadWorker(Terrain* terrain, int zoneX, int zoneZ, bool save);
+    // Save the given chunks of an unloaded zone
+    SaveLoadWorker(Terrain* terrain, int zoneX, int zoneZ, std::vector<Chunk*> chunks);
     void run() override;
 };
 #endif // SAVELOADWORKER_H
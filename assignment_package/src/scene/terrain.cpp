@@ -1,7 +1,60 @@
 #include "terrain.h"
+#include <chrono>
 #include <stdexcept>
-#include "rivers.h"
+#include "riverregistry.h"
 #include <iostream>
+#include <random>
+
+// Rivers are clipped to the zones within this many zones of the zone they
+// start in, and all rivers within this many zones of a zone are created
+// before it is generated, so the world doesn't depend on the order in
+// which zones are visited
+const static int RIVER_ZONE_REACH = 2;
+
+// Zones within this many zones of the player's zone are generated (by default)
+const static int DEFAULT_GENERATION_DISTANCE = 1;
+// Upper bound of the generation distance, 21 x 21 zones of 4 x 4 chunks
+// hold about 460MB of blocks
+const static int MAX_GENERATION_DISTANCE = 10;
+const static float DEFAULT_VIEW_DISTANCE = 256.f;
+const static float MIN_VIEW_DISTANCE = 32.f;
+// Zones loaded per tick, so that a larger generation distance or
+// the start of the game doesn't create thousands of chunks in one frame
+const static int MAX_ZONE_LOADS_PER_TICK = 4;
+// Bytes of chunk meshes sent to the GPU per frame. The closest chunks go
+// first, the others keep their previous mesh on screen for a few frames.
+// At least one mesh is sent per frame, however large.
+const static size_t UPLOAD_BUDGET_BYTES = 4 << 20;
+// Frames that spend longer than this uploading count as upload stalls
+const static uint64_t UPLOAD_STALL_NANOSECONDS = 2000000;
+// Chunk meshes on the GPU are evicted, least recently drawn first, once
+// they take more than the budget, until they take less than the low
+// water mark. Chunks drawn within the last EVICTION_MIN_AGE_FRAMES
+// frames (about two seconds) are kept.
+const static size_t GPU_MEMORY_BUDGET_BYTES = size_t(256) << 20;
+const static size_t GPU_MEMORY_LOW_WATER_PERCENT = 80;
+const static uint64_t EVICTION_MIN_AGE_FRAMES = 120;
+// Frames the meshes of a chunk's previous level of detail are kept
+// after it switched (about ten seconds), in case it switches back
+const static uint64_t LOD_CACHE_FRAMES = 600;
+// Frames between two passes over all resident chunks expiring those caches
+const static uint64_t LOD_CACHE_SWEEP_FRAMES = 60;
+// Chunks whose transparent faces are re-sorted per frame, closest first,
+// after the camera moved into another octant around them. The others
+// keep their previous order for a few frames.
+const static size_t TRANSPARENT_SORTS_PER_FRAME = 32;
+
+const char* opaqueOrderName(OpaqueOrder order) {
+    switch (order) {
+    case OpaqueOrder::Unsorted:
+        return "unsorted";
+    case OpaqueOrder::FrontToBack:
+        return "front to back";
+    case OpaqueOrder::DepthPrepass:
+        return "front to back with depth prepass";
+    }
+    return "";
+}
 
 int floorDiv(int a, int b) {
     int div = a / b;
@@ -21,19 +74,41 @@ int mod(int a, int b) {
 }
 
 Terrain::Terrain(OpenGLContext *context)
-    : m_chunks(), m_generatedTerrain(), mp_context(context),
-    m_allRivers({
-        Rivers( // default first river at spawn for demo
-                "F",
-                {{'F', "FF-[-F+F+F]+[+F-F-F]"}},
-                3,      // iterations
-                22.5,   // angle
-                9.0,    // step size
-                48.0,   // startX
-                48.0    // startZ
-                )
-    })
-{}
+    : m_meshArena(context, sizeof(Vertex)), m_chunks(), m_chunkRing(MAX_GENERATION_DISTANCE), m_chunkList(), m_chunkListVersion(0),
+    m_generatedTerrain(), m_centerZone(0, 0), m_hasCenterZone(false),
+    m_zonesToLoad(), m_zonesToUnload(), m_zonesToComplete(),
+    m_busyZones(), m_busyZonesMutex(), m_retiredZones(), m_unloadedZoneCount(0),
+    m_generationDistance(DEFAULT_GENERATION_DISTANCE), m_loadedDistance(DEFAULT_GENERATION_DISTANCE),
+    m_viewDistance(DEFAULT_VIEW_DISTANCE),
+    m_renderRegions(), m_regionChunk(0, 0), m_regionViewDistance(0.f),
+    m_opaqueDraws(), m_transparentDraws(), m_multiDraw(true),
+    m_drawOrder(), m_opaqueOrder(OpaqueOrder::FrontToBack), m_deferredSorts(0), m_overdrawMeter(context), m_measureOverdraw(false),
+    m_drawCalls(0), m_submittedFrames(0),
+    m_submitNanoseconds(0), m_uploadQueue(), m_uploadFrames(0), m_uploadedMeshes(0), m_uploadedBytes(0),
+    m_uploadNanoseconds(0), m_maxUploadNanoseconds(0), m_uploadStalls(0), m_deferredUploads(0),
+    m_frame(0), m_evictedMeshes(0), m_evictionPasses(0), m_nextEvictionFrame(0), m_expiredCachedMeshes(0),
+    m_lodSampleTime(std::chrono::steady_clock::now()), m_lodSampleRemeshes(0), m_lodRemeshesPerSecond(0.0),
+    m_chunksToDraw(),
+    m_scheduledChunk(0, 0), m_scheduledForward(0.f), m_scheduledViewDistance(0.f), m_scheduledFrustum(),
+    mp_context(context),
+    m_allRivers(),
+    m_riverZones(), m_noiseTileCache(64),
+    m_pipeline(&m_noiseTileCache, &m_allRivers),
+    m_caveDistance(1), m_incompleteZones(), m_deferredChunks(),
+    m_workerPool(), m_scheduler(&m_workerPool)
+{
+    m_allRivers.add(Rivers( // default first river at spawn for demo
+                            "F",
+                            {{'F', "FF-[-F+F+F]+[+F-F-F]"}},
+                            3,      // iterations
+                            22.5,   // angle
+                            9.0,    // step size
+                            48.0,   // startX
+                            48.0,   // startZ
+                            -RIVER_ZONE_REACH * 64, -RIVER_ZONE_REACH * 64,
+                            (RIVER_ZONE_REACH + 1) * 64 - 1, (RIVER_ZONE_REACH + 1) * 64 - 1
+                            ));
+}
 
 Terrain::~Terrain() {
     // TODO?
@@ -72,39 +147,74 @@ glm::ivec2 toCoords(int64_t k) {
     return glm::ivec2(x, z);
 }
 
+// Mix the world seed and zone coordinates into a seed for the zone's
+// random number generator (SplitMix64 finalizer)
+static uint64_t hashZone(unsigned int seed, int zoneX, int zoneZ) {
+    uint64_t h = toKey(zoneX, zoneZ) ^ (static_cast<uint64_t>(seed) * 0x9E3779B97F4A7C15ull);
+    h = (h ^ (h >> 30)) * 0xBF58476D1CE4E5B9ull;
+    h = (h ^ (h >> 27)) * 0x94D049BB133111EBull;
+    return h ^ (h >> 31);
+}
+
+void Terrain::registerRiversAround(int zoneX, int zoneZ) {
+    for (int x = zoneX - RIVER_ZONE_REACH; x <= zoneX + RIVER_ZONE_REACH; ++x) {
+        for (int z = zoneZ - RIVER_ZONE_REACH; z <= zoneZ + RIVER_ZONE_REACH; ++z) {
+            if (m_riverZones.insert(toKey(x, z)).second) {
+                createNewRiver(x, z);
+            }
+        }
+    }
+}
+
 void Terrain::createNewRiver(int zoneX, int zoneZ) {
-    double startX = (double)(zoneX + 1 + ( std::rand() % ( (zoneX + 62) - (zoneX + 1) + 1 ) ));
-    double startZ = (double)(zoneZ + 1 + ( std::rand() % ( (zoneZ + 62) - (zoneZ + 1) + 1 ) ));
+    // std::mt19937 produces the same sequence on every platform,
+    // unlike rand() or the std distributions
+    std::mt19937 rng(static_cast<std::mt19937::result_type>(hashZone(BiomeNoise::getSeed(), zoneX, zoneZ)));
+
+    // 1 in 10 chance of creating river system in a zone.
+    if (rng() % 10 != 0) {
+        return;
+    }
+
+    double startX = (double)(zoneX * 64 + 1 + rng() % 62);
+    double startZ = (double)(zoneZ * 64 + 1 + rng() % 62);
+    int iterations = (int)(3 + rng() % (5 - 3 + 1));
+    double angle = (double)(20 + rng() % (30 - 20 + 1));
+    double stepSize = (double)(5 + rng() % (15 - 5 + 1));
 
     Rivers newRiver("F",
                     {{'F', "FF-[-F+F+F]+[+F-F-F]"}},
-                    (int)(2 + std::rand() % (4 - 2 + 1)),           // iterations
-                    (double)(20 + std::rand() % (30 - 20 + 1)),     // angle
-                    (double)(5 + std::rand() % (15 - 5 + 1)),       // step size
+                    iterations,
+                    angle,
+                    stepSize,
                     startX,
-                    startZ
+                    startZ,
+                    (zoneX - RIVER_ZONE_REACH) * 64, (zoneZ - RIVER_ZONE_REACH) * 64,
+                    (zoneX + RIVER_ZONE_REACH + 1) * 64 - 1, (zoneZ + RIVER_ZONE_REACH + 1) * 64 - 1
                     );
 
-    m_allRivers.push_back(std::move(newRiver));
+    m_allRivers.add(std::move(newRiver));
 }
 
 // Surround calls to this with try-catch if you don't know whether
 // the coordinates at x, y, z have a corresponding Chunk
 BlockType Terrain::getGlobalBlockAt(int x, int y, int z) const
 {
-    if(hasChunkAt(x, z)) {
+    // Look the chunk up only once, it could be unloaded in between
+    const Chunk* c = getChunkAt(x, z);
+    if(c) {
         // Just disallow action below or above min/max height,
         // but don't crash the game over it.
         if(y < 0 || y >= 256) {
             return EMPTY;
         }
-        const uPtr<Chunk> &c = getChunkAt(x, z);
         // Check the atomic flag of the chunk to see if the block data has been generated
         if (c->hasBlockData()) {
-            glm::vec2 chunkOrigin = glm::vec2(floor(x / 16.f) * 16, floor(z / 16.f) * 16);
-            return c->getLocalBlockAt(static_cast<unsigned int>(x - chunkOrigin.x),
+            // The low 4 bits are the coordinates inside the chunk
+            // (also for negative coordinates, in two's complement)
+            return c->getLocalBlockAt(static_cast<unsigned int>(x & 15),
                                       static_cast<unsigned int>(y),
-                                      static_cast<unsigned int>(z - chunkOrigin.y));
+                                      static_cast<unsigned int>(z & 15));
         } else {
             // Not yet sure what we should return if there is no block data,
             // on one hand, returning EMPTY seems sensible,
@@ -127,43 +237,47 @@ BlockType Terrain::getGlobalBlockAt(glm::vec3 p) const {
     return getGlobalBlockAt(p.x, p.y, p.z);
 }
 
+Chunk* Terrain::lookupChunk(int chunkX, int chunkZ) const {
+    Chunk* chunk = m_chunkRing.find(chunkX, chunkZ);
+    if (chunk) {
+        return chunk;
+    }
+    chunk = m_chunks.find(toKey(chunkX << 4, chunkZ << 4));
+    if (chunk) {
+        // It was inserted while the ring moved, so the ring missed it
+        m_chunkRing.set(chunkX, chunkZ, chunk);
+    }
+    return chunk;
+}
+
 bool Terrain::hasChunkAt(int x, int z) const {
-    // Map x and z to their nearest Chunk corner
-    // By flooring x and z, then multiplying by 16,
-    // we clamp (x, z) to its nearest Chunk-space corner,
-    // then scale back to a world-space location.
-    // Note that floor() lets us handle negative numbers
-    // correctly, as floor(-1 / 16.f) gives us -1, as
-    // opposed to (int)(-1 / 16.f) giving us 0 (incorrect!).
-    int xFloor = static_cast<int>(glm::floor(x / 16.f));
-    int zFloor = static_cast<int>(glm::floor(z / 16.f));
-    return m_chunks.find(toKey(16 * xFloor, 16 * zFloor)) != m_chunks.end();
+    // Map x and z to the coordinates of their Chunk.
+    // The arithmetic shift floors, so -1 maps to chunk -1
+    // (as opposed to (int)(-1 / 16.f) giving us 0).
+    return lookupChunk(x >> 4, z >> 4) != nullptr;
 }
 
 
-uPtr<Chunk>& Terrain::getChunkAt(int x, int z) {
-    int xFloor = static_cast<int>(glm::floor(x / 16.f));
-    int zFloor = static_cast<int>(glm::floor(z / 16.f));
-    return m_chunks[toKey(16 * xFloor, 16 * zFloor)];
+Chunk* Terrain::getChunkAt(int x, int z) {
+    return lookupChunk(x >> 4, z >> 4);
 }
 
 
-const uPtr<Chunk>& Terrain::getChunkAt(int x, int z) const {
-    int xFloor = static_cast<int>(glm::floor(x / 16.f));
-    int zFloor = static_cast<int>(glm::floor(z / 16.f));
-    return m_chunks.at(toKey(16 * xFloor, 16 * zFloor));
+const Chunk* Terrain::getChunkAt(int x, int z) const {
+    return lookupChunk(x >> 4, z >> 4);
 }
 
 void Terrain::setGlobalBlockAt(int x, int y, int z, BlockType t)
 {
-    if(hasChunkAt(x, z)) {
-        uPtr<Chunk> &c = getChunkAt(x, z);
-        glm::vec2 chunkOrigin = glm::vec2(floor(x / 16.f) * 16, floor(z / 16.f) * 16);
+    Chunk* c = getChunkAt(x, z);
+    if(c) {
         if (c->hasBlockData()) {
-            c->setLocalBlockAt(static_cast<unsigned int>(x - chunkOrigin.x),
+            c->setLocalBlockAt(static_cast<unsigned int>(x & 15),
                            static_cast<unsigned int>(y),
-                           static_cast<unsigned int>(z - chunkOrigin.y),
+                           static_cast<unsigned int>(z & 15),
                            t);
+            // The block can stick out of the culling boxes of its chunk and its neighbors
+            m_renderRegions.refreshHeightRanges();
         }
     }
     else {
@@ -174,195 +288,632 @@ void Terrain::setGlobalBlockAt(int x, int y, int z, BlockType t)
 }
 
 Chunk* Terrain::instantiateChunkAt(int x, int z) {
-    uPtr<Chunk> chunk = mkU<Chunk>(mp_context, x, z, &m_allRivers);
-    Chunk *cPtr = chunk.get();
-    m_chunks[toKey(x, z)] = move(chunk);
-    // Set the neighbor pointers of itself and its neighbors
-    if(hasChunkAt(x, z + 16)) {
-        auto &chunkNorth = m_chunks[toKey(x, z + 16)];
-        cPtr->linkNeighbor(chunkNorth, ZPOS);
-    }
-    if(hasChunkAt(x, z - 16)) {
-        auto &chunkSouth = m_chunks[toKey(x, z - 16)];
-        cPtr->linkNeighbor(chunkSouth, ZNEG);
-    }
-    if(hasChunkAt(x + 16, z)) {
-        auto &chunkEast = m_chunks[toKey(x + 16, z)];
-        cPtr->linkNeighbor(chunkEast, XPOS);
-    }
-    if(hasChunkAt(x - 16, z)) {
-        auto &chunkWest = m_chunks[toKey(x - 16, z)];
-        cPtr->linkNeighbor(chunkWest, XNEG);
+    std::pair<Chunk*, bool> inserted = m_chunks.insert(toKey(x, z), mkU<Chunk>(mp_context, x, z, &m_pipeline, &m_meshArena));
+    Chunk *cPtr = inserted.first;
+    m_chunkRing.set(x >> 4, z >> 4, cPtr);
+    if (!inserted.second) {
+        // Another thread created this chunk first and links it
+        return cPtr;
     }
+    // Set the neighbor pointers of itself and its neighbors.
+    // If a neighbor is being inserted at the same time, at least one of
+    // the two finds the other (the chunk is in the map before we look),
+    // and both set the same pointers.
+    cPtr->linkNeighbor(getChunkAt(x, z + 16), ZPOS);
+    cPtr->linkNeighbor(getChunkAt(x, z - 16), ZNEG);
+    cPtr->linkNeighbor(getChunkAt(x + 16, z), XPOS);
+    cPtr->linkNeighbor(getChunkAt(x - 16, z), XNEG);
     return cPtr;
 }
 
 // Draws each Chunk with the given ShaderProgram
-void Terrain::draw(const glm::vec3 &playerPosition, ShaderProgram *shaderProgram, ShaderProgram *shaderProgramBlinnPhong, const Camera& camera) {
-    const float LOD1_DISTANCE = 64.0f;  // Medium detail
-    const float LOD2_DISTANCE = 128.0f; // Low detail
-    const float MAX_VIEW_DISTANCE = 256.0f; // Maximum render distance
+void Terrain::draw(const glm::vec3 &playerPosition, ShaderProgram *shaderProgram, ShaderProgram *shaderProgramBlinnPhong,
+                   ShaderProgram *shaderProgramDepth, const Camera& camera) {
+    // Level of detail thresholds scale with the view distance
+    const float LOD1_DISTANCE = m_viewDistance * 0.25f; // Medium detail
+    const float LOD2_DISTANCE = m_viewDistance * 0.5f;  // Low detail
+    const float MAX_VIEW_DISTANCE = m_viewDistance;     // Maximum render distance
 
     // Store the pointers to chunks to be rendered
     // we need to do this so that every chunk will have the correct LOD
     // when we draw them (otherwise, one chunk might be drawn before we 
     // realize that its neighbor has a lower LOD)
-    std::vector<Chunk*> chunksToDraw;
-    // Store the pointers to chunks whose VBO can be purged
-    // to save on GPU memory, this does NOT unload the chunk from regular memory,
-    // this will be handled in the `generate` function (since we want seperation of concerns)
-    std::vector<Chunk*> chunksToDestroy;
-    for (auto& chunkEntry : m_chunks) {
-        // Get the pointer to the chunk
-        Chunk* chunk = chunkEntry.second.get();
-
-        // Entirely ignore chunks that have not yet been released from the
-        // blocktypeworker thread
-        if (!chunk->hasBlockData()) {
-            continue;
-        }
-
-        // Calculate the distance from the player to the chunk
-        glm::vec2 chunkCenter = chunk->getCenter();
-        float distance = glm::distance(chunkCenter, glm::vec2(playerPosition.x, playerPosition.z));
-
-        // Check if the chunk is within the maximum view distance
-        if (distance < MAX_VIEW_DISTANCE) {
-            // Check if the chunk is in view
-            if (!chunk->isInView(camera)) {
-                continue;
-            }
-
-            // Update LOD level if necessary
-            int lodLevel = 0;
-            if (distance > LOD2_DISTANCE) {
-                lodLevel = 2;
-            } else if (distance > LOD1_DISTANCE) {
-                lodLevel = 1;
-            }
+    // (members, so that their memory is reused from frame to frame)
+    std::vector<Chunk*>& chunksToDraw = m_chunksToDraw;
+    chunksToDraw.clear();
+    // Chunks loaded on worker threads show up in the next snapshot
+    bool chunksChanged = false;
+    if (m_chunks.getVersion() != m_chunkListVersion) {
+        m_chunkListVersion = m_chunks.snapshot(m_chunkList);
+        chunksChanged = true;
+    }
+    glm::vec2 playerXZ(playerPosition.x, playerPosition.z);
+    glm::ivec2 playerChunk(static_cast<int>(std::floor(playerPosition.x)) >> 4,
+                           static_cast<int>(std::floor(playerPosition.z)) >> 4);
+    // Which chunks are in range and their LODs only change when the player
+    // enters another chunk, so they aren't recomputed every frame
+    if (chunksChanged || playerChunk != m_regionChunk || m_regionViewDistance != m_viewDistance) {
+        m_regionChunk = playerChunk;
+        m_regionViewDistance = m_viewDistance;
+        m_renderRegions.rebuild(m_chunkList, playerXZ, MAX_VIEW_DISTANCE,
+                                LOD1_DISTANCE, LOD2_DISTANCE);
+    }
+    // Unloaded chunks are out of the snapshot and the regions now and can be deleted
+    if (!m_retiredZones.empty()) {
+        deleteRetiredZones();
+    }
+    // Extract the frustum planes once for all the culling of this frame
+    const std::array<glm::vec4, 6> frustumPlanes = camera.getFrustumPlanes();
+    m_renderRegions.collectVisible(frustumPlanes, chunksToDraw);
+    // Each visible chunk's distance is computed once and sorted closest
+    // first: meshes are built and uploaded closest first, and drawing the
+    // opaque chunks front to back lets the depth test reject the fragments
+    // of the chunks hidden behind them before they are shaded
+    m_drawOrder.clear();
+    for (Chunk* chunk : chunksToDraw) {
+        m_drawOrder.emplace_back(glm::distance(chunk->getCenter(), playerXZ), chunk);
+    }
+    std::sort(m_drawOrder.begin(), m_drawOrder.end(),
+              [](const std::pair<float, Chunk*>& a, const std::pair<float, Chunk*>& b) { return a.first < b.first; });
 
-            // Update the LOD of the chunk
-            chunk->setLevelOfDetail(lodLevel);
-            // Add the chunk to the list of chunks to draw
-            chunksToDraw.push_back(chunk);
-        } else {
-            // Add the chunk to the list of chunks to destroy
-            chunksToDestroy.push_back(chunk);
-        }
+    // Revisiting every queued job is expensive with thousands of chunks
+    // queued, so only do it once the player moved to another chunk,
+    // turned far enough to see different chunks or changed the view distance
+    glm::vec3 forward = camera.getForward();
+    if (playerChunk != m_scheduledChunk || m_scheduledViewDistance != m_viewDistance
+        || glm::dot(forward, m_scheduledForward) < 0.97f) {
+        m_scheduledChunk = playerChunk;
+        m_scheduledForward = forward;
+        m_scheduledViewDistance = m_viewDistance;
+        m_scheduledFrustum = frustumPlanes;
+        // Work on the chunks closest to the player first,
+        // and on the ones in view before the ones behind the player
+        m_scheduler.updatePriorities([&](const Chunk* chunk, ChunkScheduler::JobKind) {
+            return jobPriority(chunk, playerXZ);
+        });
+        // Chunks that left the view distance don't need their mesh anymore.
+        // Their needsUpdate flag stays set, so they are meshed again once they come back.
+        m_scheduler.cancelIf([&](const Chunk* chunk, ChunkScheduler::JobKind kind) {
+            return kind == ChunkScheduler::MESH
+                   && glm::distance(chunk->getCenter(), playerXZ) >= MAX_VIEW_DISTANCE;
+        });
     }
+
     // For clarity, we split the process into three parts
     // First, generate the VBO data for the chunk in a separate thread
-    // when an update is requested
-    for (Chunk* chunk : chunksToDraw) {
-        if (chunk->needsUpdate()) {
-            VBOWorker* worker = new VBOWorker(chunk);
-            QThreadPool::globalInstance()->start(worker);
+    // when an update is requested (at most one job per chunk at a time).
+    // Chunks that switched back to the level of detail they had before
+    // get their cached mesh back instead.
+    for (const std::pair<float, Chunk*>& entry : m_drawOrder) {
+        Chunk* chunk = entry.second;
+        if (chunk->needsUpdate() && !chunk->restoreCachedMesh() && isReadyToMesh(chunk)
+            && !m_scheduler.isScheduled(chunk, ChunkScheduler::MESH)) {
+            m_scheduler.schedule(chunk, ChunkScheduler::MESH, entry.first);
         }
     }
-    // Second, buffer the vertex data to the GPU
-    for (Chunk* chunk : chunksToDraw) {
-        if (chunk->hasVBOData()) {
-            chunk->bufferVertexData();
+    // Along with the generation jobs queued since the last frame
+    m_scheduler.dispatch();
+    // Second, buffer the vertex data to the GPU. Uploading every finished
+    // mesh at once stalls the frame after a zone loads, so only the meshes
+    // of the closest visible chunks are sent, up to the frame's budget.
+    // The others stay MeshReady and are picked up in the next frames.
+    std::chrono::steady_clock::time_point uploadStart = std::chrono::steady_clock::now();
+    m_uploadQueue.clear();
+    for (const std::pair<float, Chunk*>& entry : m_drawOrder) {
+        if (entry.second->hasVBOData()) {
+            m_uploadQueue.push_back(entry);
         }
     }
-    // Third, draw the chunks that have been buffered
-    for (Chunk* chunk : chunksToDraw) {
-        if (chunk->hasGPUData()) {
-            chunk->draw(shaderProgram);
+    size_t uploadedBytes = 0;
+    size_t uploaded = 0;
+    for (; uploaded < m_uploadQueue.size(); ++uploaded) {
+        Chunk* chunk = m_uploadQueue[uploaded].second;
+        size_t bytes = chunk->getMeshByteSize();
+        if (uploadedBytes > 0 && uploadedBytes + bytes > UPLOAD_BUDGET_BYTES) {
+            break;
+        }
+        if (chunk->bufferVertexData()) {
+            uploadedBytes += bytes;
+            m_uploadedMeshes++;
         }
     }
-
-    glEnable(GL_CULL_FACE);
-    glCullFace(GL_BACK);
-    for (Chunk* chunk : chunksToDraw) {
-        if (chunk->hasGPUData()) {
-            chunk->drawTransparent(shaderProgramBlinnPhong);
+    m_deferredUploads = m_uploadQueue.size() - uploaded;
+    if (!m_uploadQueue.empty()) {
+        uint64_t uploadNanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - uploadStart).count();
+        m_uploadFrames++;
+        m_uploadedBytes += uploadedBytes;
+        m_uploadNanoseconds += uploadNanoseconds;
+        m_maxUploadNanoseconds = std::max(m_maxUploadNanoseconds, uploadNanoseconds);
+        if (uploadNanoseconds > UPLOAD_STALL_NANOSECONDS) {
+            m_uploadStalls++;
         }
     }
-
-    glCullFace(GL_FRONT);
-    for (Chunk* chunk : chunksToDraw) {
+    // Third, draw the chunks that have been buffered. All meshes live in
+    // the arena, so every pass is a single multi-draw call.
+    std::chrono::steady_clock::time_point submitStart = std::chrono::steady_clock::now();
+    m_opaqueDraws.clear();
+    m_transparentDraws.clear();
+    bool sorted = m_opaqueOrder != OpaqueOrder::Unsorted;
+    for (size_t i = 0; i < m_drawOrder.size(); ++i) {
+        Chunk* chunk = sorted ? m_drawOrder[i].second : chunksToDraw[i];
         if (chunk->hasGPUData()) {
-            chunk->drawTransparent(shaderProgramBlinnPhong);
+            m_meshArena.appendDraw(chunk->getOpaqueMesh(), m_opaqueDraws);
+        }
+        chunk->setLastDrawnFrame(m_frame);
+    }
+    // Transparent faces are blended back to front: the chunks farthest
+    // first, and the faces of each chunk in an order sorted for the
+    // octant around them the camera is in
+    size_t sorts = 0;
+    m_deferredSorts = 0;
+    for (const std::pair<float, Chunk*>& entry : m_drawOrder) {
+        if (sorts < TRANSPARENT_SORTS_PER_FRAME) {
+            if (entry.second->sortTransparentFaces(camera.mcr_position)) {
+                sorts++;
+            }
+        } else if (entry.second->isTransparentOrderOutdated(camera.mcr_position)) {
+            m_deferredSorts++;
+        }
+    }
+    for (auto it = m_drawOrder.rbegin(); it != m_drawOrder.rend(); ++it) {
+        if (it->second->hasGPUData()) {
+            m_meshArena.appendDraw(it->second->getTransparentMesh(), m_transparentDraws);
         }
     }
 
-    glDisable(GL_CULL_FACE);
+    bool prepass = m_opaqueOrder == OpaqueOrder::DepthPrepass;
+    if (prepass) {
+        // Lay down the depth of the opaque chunks without shading them, so
+        // that the color pass shades only the closest fragment of each pixel
+        glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+        shaderProgramDepth->drawArena(m_meshArena, m_opaqueDraws, m_multiDraw);
+        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+        // The depth is already there (the depth test is GL_LEQUAL)
+        glDepthMask(GL_FALSE);
+    }
+    if (m_measureOverdraw) {
+        m_overdrawMeter.begin();
+    }
+    shaderProgram->drawArena(m_meshArena, m_opaqueDraws, m_multiDraw);
+    if (m_measureOverdraw) {
+        m_overdrawMeter.end();
+    }
+    if (prepass) {
+        glDepthMask(GL_TRUE);
+    }
 
-    // Destroy the chunks VBO data
-    for (Chunk* chunk : chunksToDestroy) {
-        chunk->destroyVBOdata();
-        chunk->setHasGPUData(false);
+    // One pass without face culling, so that water is seen from below as
+    // well. The sorted faces don't write depth, so a face that is slightly
+    // out of order still blends instead of hiding the ones behind it.
+    glDepthMask(GL_FALSE);
+    shaderProgramBlinnPhong->drawArena(m_meshArena, m_transparentDraws, m_multiDraw);
+    glDepthMask(GL_TRUE);
+    m_submitNanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - submitStart).count();
+    m_submittedFrames++;
+    size_t opaquePasses = prepass ? 2 : 1;
+    if (m_multiDraw) {
+        m_drawCalls += (m_opaqueDraws.size() > 0 ? opaquePasses : 0) + (m_transparentDraws.size() > 0 ? 1 : 0);
+    } else {
+        m_drawCalls += opaquePasses * m_opaqueDraws.size() + m_transparentDraws.size();
+    }
+
+    // Free the GPU data of chunks that weren't drawn for the longest time
+    // once the meshes take more than the budget. This does NOT unload the
+    // chunks from regular memory, that is handled in `generate`.
+    if (m_meshArena.getUsedBytes() > GPU_MEMORY_BUDGET_BYTES && m_frame >= m_nextEvictionFrame) {
+        evictGPUData();
+    }
+    // Chunks that switched their level of detail and then left the view
+    // aren't drawn anymore, so their caches are expired in a separate pass
+    if (m_frame % LOD_CACHE_SWEEP_FRAMES == 0) {
+        expireCachedMeshes(LOD_CACHE_FRAMES);
+    }
+    m_frame++;
+
+    // Sample the rate of level of detail remeshes once per second
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    double seconds = std::chrono::duration<double>(now - m_lodSampleTime).count();
+    if (seconds >= 1.0) {
+        uint64_t remeshes = Chunk::getLevelOfDetailRemeshCount();
+        m_lodRemeshesPerSecond = (remeshes - m_lodSampleRemeshes) / seconds;
+        m_lodSampleRemeshes = remeshes;
+        m_lodSampleTime = now;
+    }
+}
+
+void Terrain::evictGPUData() {
+    m_evictionPasses++;
+    // The meshes of previous levels of detail go first, they are only
+    // drawn again if a chunk switches back
+    expireCachedMeshes(EVICTION_MIN_AGE_FRAMES);
+    std::vector<std::pair<uint64_t, Chunk*>> candidates;
+    for (Chunk* chunk : m_chunkList) {
+        // Chunks drawn recently are likely to be drawn again soon
+        // (the player turned around), evicting them would thrash uploads
+        if (chunk->hasGPUData() && chunk->getLastDrawnFrame() + EVICTION_MIN_AGE_FRAMES <= m_frame) {
+            candidates.emplace_back(chunk->getLastDrawnFrame(), chunk);
+        }
+    }
+    std::sort(candidates.begin(), candidates.end(),
+              [](const std::pair<uint64_t, Chunk*>& a, const std::pair<uint64_t, Chunk*>& b) { return a.first < b.first; });
+    // Evict down to well below the budget, so that the next few uploads
+    // don't immediately start another pass
+    size_t used = m_meshArena.getUsedBytes();
+    size_t target = GPU_MEMORY_BUDGET_BYTES / 100 * GPU_MEMORY_LOW_WATER_PERCENT;
+    bool evicted = false;
+    for (const std::pair<uint64_t, Chunk*>& candidate : candidates) {
+        if (used <= target) {
+            break;
+        }
+        used -= std::min(used, candidate.second->getGPUByteSize() + candidate.second->getCachedByteSize());
+        candidate.second->destroyGPUData();
+        m_evictedMeshes++;
+        evicted = true;
+    }
+    if (evicted) {
+        // The culling boxes of chunks without a mesh span the whole column
+        m_renderRegions.refreshHeightRanges();
+    }
+    if (used > target) {
+        // Everything left was drawn recently, try again later
+        m_nextEvictionFrame = m_frame + EVICTION_MIN_AGE_FRAMES;
+    }
+}
+
+void Terrain::expireCachedMeshes(uint64_t minAge) {
+    for (Chunk* chunk : m_chunkList) {
+        if (chunk->getCachedByteSize() > 0 && chunk->getCachedFrame() + minAge <= m_frame) {
+            chunk->releaseCachedMesh();
+            m_expiredCachedMeshes++;
+        }
     }
 }
 
 // Generate chunks in zones around the player
 void Terrain::generate(const glm::vec3 &playerPosition) {
     // Get the players zone coordinates
-    int playerZoneX = static_cast<int>(std::floor(playerPosition.x / 64.f));
-    int playerZoneZ = static_cast<int>(std::floor(playerPosition.z / 64.f));
-
-    int generationDistance = 1;
-    // Identical set to the generatedTerrain set
-    // from which we will remove the zones that are within loading distance
-    std::unordered_set<int64_t> zonesToUnload = m_generatedTerrain;
-
-    // Iterate over the zones around the player
-    for (int zoneX = playerZoneX - generationDistance; zoneX <= playerZoneX + generationDistance; ++zoneX) {
-        for (int zoneZ = playerZoneZ - generationDistance; zoneZ <= playerZoneZ + generationDistance; ++zoneZ) {
-            // Get the key for the zone
-            int64_t key = toKey(zoneX, zoneZ);
-            zonesToUnload.erase(key);
-            // Check if the zone has already been generated
-            if (m_generatedTerrain.find(key) == m_generatedTerrain.end()) {
-                m_generatedTerrain.insert(key);
-
-                // Check if there is a zone file for this zone
-                if (zoneFileExists(zoneX, zoneZ)) {
-                    // If there is a zone file, load the zone
-                    SaveLoadWorker* worker = new SaveLoadWorker(this, zoneX, zoneZ, false);
-                    worker->setAutoDelete(true);
-                    QThreadPool::globalInstance()->start(worker);
-                } else {
+    glm::ivec2 playerZone(static_cast<int>(std::floor(playerPosition.x / 64.f)),
+                          static_cast<int>(std::floor(playerPosition.z / 64.f)));
 
-                    // 1 in 10 chance of creating river system in a zone.
-                    if (rand() % 10 == 0) {
-                        createNewRiver(zoneX, zoneZ);
-                    }
+    // The set of zones around the player only changes when they cross
+    // into another zone, or when the generation distance changes
+    if (!m_hasCenterZone || playerZone != m_centerZone || m_loadedDistance != m_generationDistance) {
+        moveCenterZone(playerZone, playerPosition);
+    }
+    if (!m_zonesToLoad.empty() || !m_zonesToUnload.empty() || !m_zonesToComplete.empty()) {
+        processPendingZones(playerPosition);
+    }
+    m_scheduler.dispatch();
+}
+
+void Terrain::moveCenterZone(glm::ivec2 zone, const glm::vec3& playerPosition) {
+    auto isAround = [](glm::ivec2 center, int distance, int zoneX, int zoneZ) {
+        return std::max(std::abs(zoneX - center.x), std::abs(zoneZ - center.y)) <= distance;
+    };
+    glm::ivec2 previousZone = m_centerZone;
+    int previousDistance = m_loadedDistance;
+    bool hadPreviousZone = m_hasCenterZone;
+    int generationDistance = m_generationDistance;
+    m_centerZone = zone;
+    m_loadedDistance = generationDistance;
+    m_hasCenterZone = true;
+
+    // Zones that left the generation distance
+    if (hadPreviousZone) {
+        for (int zoneX = previousZone.x - previousDistance; zoneX <= previousZone.x + previousDistance; ++zoneX) {
+            for (int zoneZ = previousZone.y - previousDistance; zoneZ <= previousZone.y + previousDistance; ++zoneZ) {
+                if (isAround(zone, generationDistance, zoneX, zoneZ)) {
+                    continue;
+                }
+                int64_t key = toKey(zoneX, zoneZ);
+                m_zonesToLoad.erase(key);
+                m_zonesToComplete.erase(key);
+                if (m_generatedTerrain.count(key)) {
+                    m_zonesToUnload.insert(key);
+                }
+            }
+        }
+    }
 
-                    // If the zone hasn't been generated, iterate over the chunks in the zone
+    // Zones that entered it
+    for (int zoneX = zone.x - generationDistance; zoneX <= zone.x + generationDistance; ++zoneX) {
+        for (int zoneZ = zone.y - generationDistance; zoneZ <= zone.y + generationDistance; ++zoneZ) {
+            int64_t key = toKey(zoneX, zoneZ);
+            if (!hadPreviousZone || !isAround(previousZone, previousDistance, zoneX, zoneZ)) {
+                m_zonesToUnload.erase(key);
+                if (m_generatedTerrain.count(key)) {
+                    // The player came back before the zone was unloaded. Restart the
+                    // generation of the chunks that were cancelled when they left.
+                    StageMask stages = stagesForZone(zoneX, zoneZ);
                     for (int x = zoneX * 64; x < zoneX * 64 + 64; x += 16) {
                         for (int z = zoneZ * 64; z < zoneZ * 64 + 64; z += 16) {
-                            // Check if the chunk has already been generated
-                            // (theoretically, this shouldn't happen, but it adds 
-                            // an additional failsafe)
-                            if (!hasChunkAt(x, z)) {
-                                // Create the new chunk
-                                Chunk* chunk = instantiateChunkAt(x, z);
-                                // Create a new worker thread to generate the block data for this chunk
-                                BlockTypeWorker* worker = new BlockTypeWorker(chunk);
-                                worker->setAutoDelete(true);
-                                QThreadPool::globalInstance()->start(worker);
+                            Chunk* chunk = getChunkAt(x, z);
+                            if (chunk && m_deferredChunks.erase(chunk)) {
+                                if (stages != ALL_GENERATION_STAGES) {
+                                    m_incompleteZones.insert(key);
+                                }
+                                scheduleGeneration(chunk, stages, playerPosition);
                             }
                         }
                     }
-                }   
+                } else {
+                    m_zonesToLoad.insert(key);
+                }
+            }
+            // The player came close enough to a zone that skipped some stages
+            if (m_incompleteZones.count(key) && stagesForZone(zoneX, zoneZ) == ALL_GENERATION_STAGES) {
+                m_zonesToComplete.insert(key);
+            }
+        }
+    }
+
+    // Move the lookup grid along with the player
+    m_chunkRing.setZoneRadius(generationDistance);
+    m_chunkRing.recenter(zone.x, zone.y, [this](int chunkX, int chunkZ) {
+        return m_chunks.find(toKey(chunkX << 4, chunkZ << 4));
+    });
+
+    // Drop the queued first generation passes of chunks
+    // whose zone is out of the generation distance now
+    std::vector<Chunk*> cancelled = m_scheduler.cancelIf([&](const Chunk* chunk, ChunkScheduler::JobKind kind) {
+        if (kind != ChunkScheduler::GENERATE || chunk->hasBlockData()) {
+            return false;
+        }
+        glm::ivec2 corner = chunk->getCorner();
+        return !isAround(zone, generationDistance, floorDiv(corner.x, 64), floorDiv(corner.y, 64));
+    });
+    m_deferredChunks.insert(cancelled.begin(), cancelled.end());
+}
+
+float Terrain::jobPriority(const Chunk* chunk, glm::vec2 playerXZ) const {
+    float priority = glm::distance(chunk->getCenter(), playerXZ);
+    if (!chunk->isInView(m_scheduledFrustum)) {
+        priority += m_viewDistance;
+    }
+    return priority;
+}
+
+void Terrain::processPendingZones(const glm::vec3& playerPosition) {
+    // Unload first, so that the zones that replace them can reuse the memory
+    for (auto it = m_zonesToUnload.begin(); it != m_zonesToUnload.end();) {
+        glm::ivec2 zone = toCoords(*it);
+        if (unloadZone(zone.x, zone.y)) {
+            it = m_zonesToUnload.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    if (!m_zonesToLoad.empty()) {
+        // Load the zones closest to the player first, a few per tick
+        std::vector<glm::ivec2> zones;
+        zones.reserve(m_zonesToLoad.size());
+        for (int64_t key : m_zonesToLoad) {
+            // Wait until the zone is done saving from the last time it was unloaded
+            if (!isZoneBusy(key)) {
+                zones.push_back(toCoords(key));
             }
         }
+        auto ringDistance = [this](glm::ivec2 zone) {
+            return std::max(std::abs(zone.x - m_centerZone.x), std::abs(zone.y - m_centerZone.y));
+        };
+        size_t count = std::min<size_t>(zones.size(), MAX_ZONE_LOADS_PER_TICK);
+        std::partial_sort(zones.begin(), zones.begin() + count, zones.end(),
+                          [&](glm::ivec2 a, glm::ivec2 b) { return ringDistance(a) < ringDistance(b); });
+        for (size_t i = 0; i < count; ++i) {
+            loadOrGenerateZone(zones[i].x, zones[i].y, playerPosition);
+            m_zonesToLoad.erase(toKey(zones[i].x, zones[i].y));
+        }
+    }
+    for (auto it = m_zonesToComplete.begin(); it != m_zonesToComplete.end();) {
+        glm::ivec2 zone = toCoords(*it);
+        if (completeZone(zone.x, zone.y, playerPosition)) {
+            m_incompleteZones.erase(*it);
+            it = m_zonesToComplete.erase(it);
+        } else {
+            ++it;
+        }
     }
 }
 
-void Terrain::unloadZone(int zoneX, int zoneZ) {
-    // Remove the chunks of this zone from m_chunks
+void Terrain::loadOrGenerateZone(int zoneX, int zoneZ, const glm::vec3& playerPosition) {
+    int64_t key = toKey(zoneX, zoneZ);
+    m_generatedTerrain.insert(key);
+    // Saved zones are diffed against the generated terrain,
+    // so they need the same rivers as freshly generated ones
+    registerRiversAround(zoneX, zoneZ);
+
+    // Check if there is a zone file for this zone
+    if (zoneFileExists(zoneX, zoneZ)) {
+        // If there is a zone file, load the zone
+        SaveLoadWorker* worker = new SaveLoadWorker(this, zoneX, zoneZ, false);
+        worker->setAutoDelete(true);
+        reserveZone(key);
+        m_workerPool.start(worker);
+        return;
+    }
+
+    // Far away zones skip the expensive cave stage
+    StageMask stages = stagesForZone(zoneX, zoneZ);
+    if (stages != ALL_GENERATION_STAGES) {
+        m_incompleteZones.insert(key);
+    }
+
+    // If the zone hasn't been generated, iterate over the chunks in the zone
     for (int x = zoneX * 64; x < zoneX * 64 + 64; x += 16) {
         for (int z = zoneZ * 64; z < zoneZ * 64 + 64; z += 16) {
-            if (hasChunkAt(x, z)) {
-                m_chunks.erase(toKey(x, z));
+            // Check if the chunk has already been generated
+            // (theoretically, this shouldn't happen, but it adds
+            // an additional failsafe)
+            if (!hasChunkAt(x, z)) {
+                // Create the new chunk
+                Chunk* chunk = instantiateChunkAt(x, z);
+                // Queue the generation of the block data for this chunk
+                scheduleGeneration(chunk, stages, playerPosition);
             }
         }
     }
-    // Remove the zone from m_generatedTerrain
-    m_generatedTerrain.erase(toKey(zoneX, zoneZ));
+}
+
+StageMask Terrain::stagesForZone(int zoneX, int zoneZ) const {
+    int ringDistance = std::max(std::abs(zoneX - m_centerZone.x), std::abs(zoneZ - m_centerZone.y));
+    StageMask stages = ALL_GENERATION_STAGES;
+    if (ringDistance > m_caveDistance) {
+        stages &= ~stageBit(CAVES);
+    }
+    return stages;
+}
+
+bool Terrain::isReadyToMesh(const Chunk* chunk) const {
+    if (!chunk->hasBlockData()) {
+        return false;
+    }
+    for (Direction dir : {XPOS, XNEG, ZPOS, ZNEG}) {
+        const Chunk* neighbor = chunk->getNeighbor(dir);
+        // Neighbors whose generation was cancelled won't get block data
+        // any time soon, so they don't hold back the chunk
+        if (neighbor && !neighbor->hasBlockData()
+            && m_deferredChunks.find(neighbor) == m_deferredChunks.end()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void Terrain::scheduleGeneration(Chunk* chunk, StageMask stages, const glm::vec3& playerPosition) {
+    float priority = jobPriority(chunk, glm::vec2(playerPosition.x, playerPosition.z));
+    m_scheduler.schedule(chunk, ChunkScheduler::GENERATE, priority, stages);
+}
+
+bool Terrain::completeZone(int zoneX, int zoneZ, const glm::vec3& playerPosition) {
+    // Wait until the first generation pass of every chunk is done,
+    // otherwise the completion could run before it
+    for (int x = zoneX * 64; x < zoneX * 64 + 64; x += 16) {
+        for (int z = zoneZ * 64; z < zoneZ * 64 + 64; z += 16) {
+            const Chunk* chunk = getChunkAt(x, z);
+            if (chunk && !chunk->hasBlockData()) {
+                return false;
+            }
+        }
+    }
+    for (int x = zoneX * 64; x < zoneX * 64 + 64; x += 16) {
+        for (int z = zoneZ * 64; z < zoneZ * 64 + 64; z += 16) {
+            Chunk* chunk = getChunkAt(x, z);
+            if (chunk) {
+                scheduleGeneration(chunk, ALL_GENERATION_STAGES, playerPosition);
+            }
+        }
+    }
+    return true;
+}
+
+bool Terrain::unloadZone(int zoneX, int zoneZ) {
+    int64_t key = toKey(zoneX, zoneZ);
+    // Loads of the zones next to it link their chunks to ours
+    if (isZoneBusy(key) || isZoneBusy(toKey(zoneX + 1, zoneZ)) || isZoneBusy(toKey(zoneX - 1, zoneZ))
+        || isZoneBusy(toKey(zoneX, zoneZ + 1)) || isZoneBusy(toKey(zoneX, zoneZ - 1))) {
+        return false;
+    }
+
+    std::vector<Chunk*> chunks;
+    for (int x = zoneX * 64; x < zoneX * 64 + 64; x += 16) {
+        for (int z = zoneZ * 64; z < zoneZ * 64 + 64; z += 16) {
+            Chunk* chunk = getChunkAt(x, z);
+            if (chunk) {
+                chunks.push_back(chunk);
+            }
+        }
+    }
+
+    // Queued jobs of the zone are of no use anymore. Chunks that lose their
+    // generation are picked up again if the player comes back before the
+    // zone could be unloaded.
+    std::vector<Chunk*> cancelled = m_scheduler.cancelIf([&](const Chunk* chunk, ChunkScheduler::JobKind) {
+        glm::ivec2 corner = chunk->getCorner();
+        return floorDiv(corner.x, 64) == zoneX && floorDiv(corner.y, 64) == zoneZ;
+    });
+    for (Chunk* chunk : cancelled) {
+        if (!chunk->hasBlockData()) {
+            m_deferredChunks.insert(chunk);
+        }
+    }
+    // Running jobs of the zone's chunks, and jobs of their neighbors
+    // (which read the blocks along the zone's border) have to finish first.
+    // New jobs are only scheduled from this thread, so none can start
+    // while the zone is taken apart below.
+    auto isBusy = [this](const Chunk* chunk) {
+        return m_scheduler.isScheduled(chunk, ChunkScheduler::GENERATE)
+               || m_scheduler.isScheduled(chunk, ChunkScheduler::MESH);
+    };
+    for (Chunk* chunk : chunks) {
+        if (isBusy(chunk)) {
+            return false;
+        }
+        for (Direction dir : {XPOS, XNEG, ZPOS, ZNEG}) {
+            const Chunk* neighbor = chunk->getNeighbor(dir);
+            if (neighbor && isBusy(neighbor)) {
+                return false;
+            }
+        }
+    }
+
+    RetiredZone retired{zoneX, zoneZ, {}};
+    bool modified = false;
+    for (Chunk* chunk : chunks) {
+        modified = modified || chunk->isModified();
+        chunk->unlinkNeighbors();
+        m_deferredChunks.erase(chunk);
+        glm::ivec2 corner = chunk->getCorner();
+        m_chunkRing.remove(corner.x >> 4, corner.y >> 4);
+        retired.chunks.push_back(m_chunks.erase(toKey(corner.x, corner.y)));
+    }
+    m_generatedTerrain.erase(key);
+    m_incompleteZones.erase(key);
+    m_zonesToComplete.erase(key);
+    m_unloadedZoneCount++;
+
+    // Unmodified zones are regenerated (or loaded from their
+    // existing zone file) when the player comes back
+    if (modified) {
+        reserveZone(key);
+        SaveLoadWorker* worker = new SaveLoadWorker(this, zoneX, zoneZ, chunks);
+        worker->setAutoDelete(true);
+        m_workerPool.start(worker);
+    }
+    m_retiredZones.push_back(std::move(retired));
+    return true;
+}
+
+void Terrain::deleteRetiredZones() {
+    for (auto it = m_retiredZones.begin(); it != m_retiredZones.end();) {
+        if (isZoneBusy(toKey(it->zoneX, it->zoneZ))) {
+            ++it;
+            continue;
+        }
+        for (uPtr<Chunk>& chunk : it->chunks) {
+            chunk->destroyGPUData();
+        }
+        it = m_retiredZones.erase(it);
+    }
+}
+
+void Terrain::reserveZone(int64_t key) {
+    QMutexLocker locker(&m_busyZonesMutex);
+    m_busyZones[key]++;
+}
+
+void Terrain::releaseZone(int zoneX, int zoneZ) {
+    QMutexLocker locker(&m_busyZonesMutex);
+    auto it = m_busyZones.find(toKey(zoneX, zoneZ));
+    if (it != m_busyZones.end() && --it->second == 0) {
+        m_busyZones.erase(it);
+    }
+}
+
+bool Terrain::isZoneBusy(int64_t key) const {
+    QMutexLocker locker(&m_busyZonesMutex);
+    return m_busyZones.count(key) > 0;
 }
 
 bool Terrain::zoneFileExists(int zoneX, int zoneZ) {
@@ -376,6 +927,19 @@ bool Terrain::zoneFileExists(int zoneX, int zoneZ) {
 }
 
 void Terrain::saveZone(int zoneX, int zoneZ) {
+    std::vector<Chunk*> chunks;
+    for (int chunkX = zoneX * 64; chunkX < zoneX * 64 + 64; chunkX += 16) {
+        for (int chunkZ = zoneZ * 64; chunkZ < zoneZ * 64 + 64; chunkZ += 16) {
+            Chunk* chunk = getChunkAt(chunkX, chunkZ);
+            if (chunk) {
+                chunks.push_back(chunk);
+            }
+        }
+    }
+    writeZone(zoneX, zoneZ, chunks);
+}
+
+void Terrain::writeZone(int zoneX, int zoneZ, const std::vector<Chunk*>& chunks) {
     int regionX = floorDiv(zoneX, 4);
     int regionZ = floorDiv(zoneZ, 4);
 
@@ -394,23 +958,19 @@ void Terrain::saveZone(int zoneX, int zoneZ) {
         return;
     }
 
-    for (int chunkX = zoneX * 64; chunkX < zoneX * 64 + 64; chunkX += 16) {
-        for (int chunkZ = zoneZ * 64; chunkZ < zoneZ * 64 + 64; chunkZ += 16) {
-            if (hasChunkAt(chunkX, chunkZ)) {
-                Chunk* chunk = getChunkAt(chunkX, chunkZ).get();
-                // Save the chunk only if its block data has been generated
-                if (chunk->hasBlockData()) {
-                    int chunkIndexX = floorDiv(chunkX, 16);
-                    int chunkIndexZ = floorDiv(chunkZ, 16);
-
-                    uint8_t localChunkX = mod(chunkIndexX, 4);
-                    uint8_t localChunkZ = mod(chunkIndexZ, 4);
-
-                    ofs.put(static_cast<char>(localChunkX));
-                    ofs.put(static_cast<char>(localChunkZ));
-                    chunk->serializeModifiedBlocks(ofs);
-                }
-            }
+    for (Chunk* chunk : chunks) {
+        // Save the chunk only if its block data has been generated
+        if (chunk->hasBlockData()) {
+            glm::ivec2 corner = chunk->getCorner();
+            int chunkIndexX = floorDiv(corner.x, 16);
+            int chunkIndexZ = floorDiv(corner.y, 16);
+
+            uint8_t localChunkX = mod(chunkIndexX, 4);
+            uint8_t localChunkZ = mod(chunkIndexZ, 4);
+
+            ofs.put(static_cast<char>(localChunkX));
+            ofs.put(static_cast<char>(localChunkZ));
+            chunk->serializeModifiedBlocks(ofs);
         }
     }
     ofs.close();
@@ -436,34 +996,197 @@ void Terrain::loadZone(int zoneX, int zoneZ) {
         int chunkX = zoneX * 4 + localChunkX;
         int chunkZ = zoneZ * 4 + localChunkZ;
 
-        Chunk* chunk = nullptr;
-
-        if (hasChunkAt(chunkX * 16, chunkZ * 16)) {
-            chunk = getChunkAt(chunkX * 16, chunkZ * 16).get();
-        } else {
+        Chunk* chunk = getChunkAt(chunkX * 16, chunkZ * 16);
+        if (!chunk) {
             chunk = instantiateChunkAt(chunkX * 16, chunkZ * 16);
         }
-        chunk->setHasBlockData(false);
-        chunk->setHasGPUData(false);
-        chunk->setHasVBOData(false);
-        chunk->destroyVBOdata();
-        // Generate the chunk
+        // Generate the chunk. This also makes sure that meshes
+        // still being built from the previous blocks are dropped.
         chunk->generate();
         // Deserialize modified blocks
         chunk->deserializeModifiedBlocks(ifs);
         // Mark the chunk as having block data generated
-        chunk->setHasBlockData(true);
-        chunk->setNeedsUpdate(true);
+        chunk->finishGeneration();
     }
 
     ifs.close();
+
+    // Chunks that had no block data yet when the zone was saved
+    // aren't in the file, generate them from scratch
+    for (int x = zoneX * 64; x < zoneX * 64 + 64; x += 16) {
+        for (int z = zoneZ * 64; z < zoneZ * 64 + 64; z += 16) {
+            if (!hasChunkAt(x, z)) {
+                Chunk* chunk = instantiateChunkAt(x, z);
+                chunk->generate();
+                chunk->finishGeneration();
+            }
+        }
+    }
 }
 
 void Terrain::saveTerrain() {
+    std::vector<QRunnable*> workers;
     for (const auto& zoneKey : m_generatedTerrain) {
         glm::ivec2 zoneCoords = toCoords(zoneKey);
         std::cout << "Saving zone at " << zoneCoords.x << ", " << zoneCoords.y << std::endl;
         SaveLoadWorker* worker = new SaveLoadWorker(this, zoneCoords.x, zoneCoords.y, true);
-        QThreadPool::globalInstance()->start(worker);
+        worker->setAutoDelete(true);
+        reserveZone(zoneKey);
+        workers.push_back(worker);
+    }
+    m_workerPool.startBatch(workers);
+}
+
+void Terrain::setGenerationDistance(int zones) {
+    // The new zones are streamed in (or out) by the next generate()
+    m_generationDistance = glm::clamp(zones, 1, MAX_GENERATION_DISTANCE);
+    // Keep enough noise tiles for every loaded zone and the zones around them
+    int side = 2 * m_generationDistance + 3;
+    m_noiseTileCache.setCapacity(std::max<size_t>(64, side * side));
+}
+
+int Terrain::getGenerationDistance() const {
+    return m_generationDistance;
+}
+
+void Terrain::setViewDistance(float distance) {
+    m_viewDistance = glm::clamp(distance, MIN_VIEW_DISTANCE, (MAX_GENERATION_DISTANCE + 1) * 64.f);
+}
+
+float Terrain::getViewDistance() const {
+    return m_viewDistance;
+}
+
+void Terrain::waitForWorkers() {
+    m_workerPool.waitForDone();
+}
+
+void Terrain::setMultiDraw(bool multiDraw) {
+    m_multiDraw = multiDraw;
+    // Average the submission stats of the new mode only
+    m_drawCalls = 0;
+    m_submittedFrames = 0;
+    m_submitNanoseconds = 0;
+}
+
+bool Terrain::isMultiDraw() const {
+    return m_multiDraw;
+}
+
+void Terrain::setOpaqueOrder(OpaqueOrder order) {
+    m_opaqueOrder = order;
+    // Measure the new order only
+    m_overdrawMeter.reset();
+    m_drawCalls = 0;
+    m_submittedFrames = 0;
+    m_submitNanoseconds = 0;
+}
+
+OpaqueOrder Terrain::getOpaqueOrder() const {
+    return m_opaqueOrder;
+}
+
+void Terrain::setMeasureOverdraw(bool measure) {
+    m_measureOverdraw = measure;
+    m_overdrawMeter.reset();
+}
+
+bool Terrain::isMeasuringOverdraw() const {
+    return m_measureOverdraw;
+}
+
+const NoiseTileCache& Terrain::getNoiseTileCache() const {
+    return m_noiseTileCache;
+}
+
+GenerationPipeline& Terrain::getPipeline() {
+    return m_pipeline;
+}
+
+void Terrain::printStats(std::ostream& os) const {
+    os << "Noise tiles: " << m_noiseTileCache.size() << "/" << m_noiseTileCache.capacity()
+       << " cached, " << m_noiseTileCache.getHits() << " hits, "
+       << m_noiseTileCache.getMisses() << " misses ("
+       << static_cast<int>(m_noiseTileCache.getHitRate() * 100.f) << "% hit rate)" << std::endl;
+    os << "Generation stages:";
+    for (const GenerationPipeline::StageStats& stage : m_pipeline.getStageStats()) {
+        double avgMs = stage.runs == 0 ? 0.0 : stage.nanoseconds / 1e6 / stage.runs;
+        os << " " << stage.name << " " << avgMs << "ms (" << stage.runs << " runs)";
+    }
+    os << std::endl;
+    const char* jobNames[ChunkScheduler::NUM_JOB_KINDS] = {"generate", "mesh"};
+    for (int kind = 0; kind < ChunkScheduler::NUM_JOB_KINDS; ++kind) {
+        ChunkScheduler::KindStats stats = m_scheduler.getStats(static_cast<ChunkScheduler::JobKind>(kind));
+        double avgWaitMs = stats.completed == 0 ? 0.0 : stats.waitNanoseconds / 1e6 / stats.completed;
+        double avgRunMs = stats.completed == 0 ? 0.0 : stats.runNanoseconds / 1e6 / stats.completed;
+        os << "Jobs " << jobNames[kind] << ": " << stats.queued << " queued, "
+           << stats.running << " running, " << stats.completed << " done, "
+           << stats.cancelled << " cancelled, wait " << avgWaitMs << "ms avg / "
+           << stats.maxWaitNanoseconds / 1e6 << "ms max, run " << avgRunMs << "ms avg" << std::endl;
+    }
+    uint64_t generated = m_scheduler.getStats(ChunkScheduler::GENERATE).completed;
+    uint64_t meshed = m_scheduler.getStats(ChunkScheduler::MESH).completed;
+    os << "Meshes per generated chunk: " << (generated == 0 ? 0.0 : static_cast<double>(meshed) / generated)
+       << ", outdated meshes discarded: " << Chunk::getDiscardedMeshCount() << std::endl;
+    os << "Generation distance: " << m_generationDistance << " zones, view distance: "
+       << m_viewDistance << " blocks, " << m_chunkList.size() << " chunks resident, "
+       << m_chunksToDraw.size() << " drawn" << std::endl;
+    os << "Zones: " << m_generatedTerrain.size() << " loaded, " << m_zonesToLoad.size() << " waiting to load, "
+       << m_zonesToUnload.size() << " waiting to unload, " << m_unloadedZoneCount << " unloaded" << std::endl;
+    MeshArena::Stats arena = m_meshArena.getStats();
+    os << "Mesh arena: " << arena.meshes << " meshes, vertices " << arena.verticesUsed << "/" << arena.vertexCapacity
+       << " in " << arena.vertexFreeRanges << " free ranges, indices " << arena.indicesUsed << "/" << arena.indexCapacity
+       << " in " << arena.indexFreeRanges << " free ranges, " << arena.defragmentations << " defragmentations, "
+       << arena.growths << " growths" << std::endl;
+    if (m_uploadFrames > 0) {
+        os << "Mesh uploads: " << m_uploadedMeshes << " meshes, "
+           << m_uploadedBytes / m_uploadFrames / 1024.0 << "KB and "
+           << m_uploadNanoseconds / m_uploadFrames / 1000.0 << "us per uploading frame, "
+           << m_maxUploadNanoseconds / 1e6 << "ms max, " << m_uploadStalls << " stalls over "
+           << UPLOAD_STALL_NANOSECONDS / 1e6 << "ms, " << m_deferredUploads << " waiting, "
+           << arena.stagingOrphans << " staging buffer refills" << std::endl;
+    }
+    if (m_submittedFrames > 0) {
+        os << "Chunk submission (" << (m_multiDraw ? "multi-draw" : "one draw per mesh") << "): "
+           << static_cast<double>(m_drawCalls) / m_submittedFrames << " draw calls and "
+           << m_submitNanoseconds / m_submittedFrames / 1000.0 << "us per frame" << std::endl;
+    }
+    os << "Transparent faces: " << Chunk::getTransparentSortCount() << " chunks sorted, "
+       << m_deferredSorts << " waiting last frame" << std::endl;
+    if (m_overdrawMeter.getMeasuredFrames() > 0) {
+        os << "Opaque overdraw (" << opaqueOrderName(m_opaqueOrder) << "): "
+           << m_overdrawMeter.getFragmentsPerPixel() << " fragments shaded per pixel over "
+           << m_overdrawMeter.getMeasuredFrames() << " frames" << std::endl;
+    }
+    // Resident mesh memory by level of detail
+    std::array<size_t, 3> lodBytes = {0, 0, 0};
+    std::array<size_t, 3> lodChunks = {0, 0, 0};
+    size_t cachedBytes = 0;
+    for (const Chunk* chunk : m_chunkList) {
+        cachedBytes += chunk->getCachedByteSize();
+        if (chunk->hasGPUData()) {
+            int lod = glm::clamp(chunk->getGPULevelOfDetail(), 0, 2);
+            lodBytes[lod] += chunk->getGPUByteSize();
+            lodChunks[lod]++;
+        }
+    }
+    os << "GPU meshes: " << m_meshArena.getUsedBytes() / 1048576.0 << "MB of "
+       << GPU_MEMORY_BUDGET_BYTES / 1048576.0 << "MB budget";
+    for (int lod = 0; lod < 3; ++lod) {
+        os << ", LOD " << lod << " " << lodBytes[lod] / 1048576.0 << "MB (" << lodChunks[lod] << " chunks)";
     }
+    os << ", previous LODs " << cachedBytes / 1048576.0 << "MB (" << m_expiredCachedMeshes << " expired)";
+    os << ", " << m_evictedMeshes << " evicted in " << m_evictionPasses << " passes" << std::endl;
+    os << "LOD switches: " << m_lodRemeshesPerSecond << " remeshes/s, "
+       << Chunk::getLevelOfDetailRemeshCount() << " remeshed, "
+       << Chunk::getCachedMeshRestoreCount() << " restored from the cache" << std::endl;
+    RenderRegions::Stats regions = m_renderRegions.getStats();
+    os << "Render regions: " << regions.chunks << " chunks in range in " << regions.regions << " regions, "
+       << regions.rebuilds << " rebuilds; last frame " << regions.regionsCulled << " regions culled, "
+       << regions.regionsInside << " fully visible, " << regions.chunksTested << " chunks tested" << std::endl;
+    os << "Chunk lookups: " << m_chunkRing.getHits() << " from the ring, "
+       << m_chunkRing.getMisses() << " from the map" << std::endl;
+    os << "Worker pool: " << m_workerPool.threadCount() << " threads, "
+       << m_workerPool.getExecutedCount() << " jobs, " << m_workerPool.getStolenCount() << " stolen, "
+       << m_scheduler.getJobObjectCount() << " chunk job objects" << std::endl;
 }
@@ -3,6 +3,7 @@
 #include "glm_includes.h"
 #include "chunk.h"
 #include <array>
+#include <chrono>
 #include <unordered_map>
 #include <unordered_set>
 #include <fstream>
@@ -10,13 +11,20 @@
 #include "cube.h"
 #include <QThread>
 #include <QMutex>
-#include <QThreadPool>
 #include <QDir>
 #include "blocktypeworker.h"
 #include "vboworker.h"
 
-#include "rivers.h"
+#include "riverregistry.h"
 #include "saveloadworker.h"
+#include "noisetilecache.h"
+#include "generationpipeline.h"
+#include "chunkscheduler.h"
+#include "chunkmap.h"
+#include "chunkring.h"
+#include "renderregions.h"
+#include "mesharena.h"
+#include "overdrawmeter.h"
 
 
 //using namespace std;
@@ -25,18 +33,43 @@
 int64_t toKey(int x, int z);
 glm::ivec2 toCoords(int64_t k);
 
+// How the opaque chunks are ordered when drawn, from most to least overdraw
+enum class OpaqueOrder : unsigned char
+{
+    Unsorted,       // In the order the render regions return them
+    FrontToBack,    // Closest first, so that the depth test rejects hidden fragments
+    DepthPrepass    // Front to back, after a depth-only pass over the same chunks
+};
+// Name of the order, for printing
+const char* opaqueOrderName(OpaqueOrder order);
+
 // The container class for all of the Chunks in the game.
-// Ultimately, while Terrain will always store all Chunks,
-// not all Chunks will be drawn at any given time as the world
-// expands.
+// Terrain stores the Chunks of the zones around the player,
+// zones are streamed in and out as the player moves, and
+// not all stored Chunks are drawn at any given time.
 class Terrain {
 private:
+    // The meshes of all chunks on the GPU. Declared before the chunks,
+    // which give their meshes back when they are destroyed.
+    MeshArena m_meshArena;
     // Stores every Chunk according to the location of its lower-left corner
     // in world space.
     // We combine the X and Z coordinates of the Chunk's corner into one 64-bit int
     // so that we can use them as a key for the map, as objects like std::pairs or
     // glm::ivec2s are not hashable by default, so they cannot be used as keys.
-    std::unordered_map<int64_t, uPtr<Chunk>> m_chunks;
+    // Zones loaded from disk insert their chunks from a worker thread,
+    // so the map is a concurrent one.
+    ChunkMap m_chunks;
+    // Grid of the chunks around the player in front of m_chunks,
+    // so that most lookups don't need to hash or lock.
+    // Mutable since lookups refill it.
+    mutable ChunkRing m_chunkRing;
+    // Find a chunk by its chunk coordinates (world coordinates / 16)
+    Chunk* lookupChunk(int chunkX, int chunkZ) const;
+    // The chunks the render thread iterates over, a snapshot of m_chunks
+    // that is only retaken after chunks were added or removed
+    std::vector<Chunk*> m_chunkList;
+    uint64_t m_chunkListVersion;
 
     // We will designate every 64 x 64 area of the world's x-z plane
     // as one "terrain generation zone". Every time the player moves
@@ -48,34 +81,181 @@ private:
     // one 64 x 64 area with its lower-left corner at (0, 0).
     // When milestone 1 has been implemented, the Player can move around the
     // world to add more "terrain generation zone" IDs to this set.
-    // While only the 3 x 3 collection of terrain generation zones
-    // surrounding the Player should be rendered, the Chunks
-    // in the Terrain will never be deleted until the program is terminated.
+    // Only the zones within the generation distance of the player are
+    // kept, zones the player leaves are unloaded (and saved if modified).
     std::unordered_set<int64_t> m_generatedTerrain;
 
+    // --- Zone streaming ---
+    // The zone the player was in at the last generate(),
+    // the square of loaded zones is centered on it
+    glm::ivec2 m_centerZone;
+    bool m_hasCenterZone;
+    // Zones that entered or left the generation distance and still have
+    // to be loaded, unloaded or completed. They only ever hold zones
+    // around the player and are retried every tick until they succeed.
+    std::unordered_set<int64_t> m_zonesToLoad;
+    std::unordered_set<int64_t> m_zonesToUnload;
+    std::unordered_set<int64_t> m_zonesToComplete;
+    // Number of save and load jobs in flight per zone. A busy zone is
+    // neither loaded nor unloaded until its jobs are done.
+    std::unordered_map<int64_t, int> m_busyZones;
+    mutable QMutex m_busyZonesMutex;
+    // Chunks of unloaded zones. They are deleted on the render thread
+    // (which frees their GPU buffers) once their zone is saved.
+    struct RetiredZone {
+        int zoneX, zoneZ;
+        std::vector<uPtr<Chunk>> chunks;
+    };
+    std::vector<RetiredZone> m_retiredZones;
+    uint64_t m_unloadedZoneCount;
+    // Radius of the square of zones kept loaded around the player (in zones),
+    // and the radius the currently loaded zones were streamed in with
+    int m_generationDistance;
+    int m_loadedDistance;
+    // Chunks further away than this are not drawn, in blocks.
+    // The level of detail drops at a quarter and at half of it.
+    float m_viewDistance;
+    // The chunks within the view distance, grouped into regions for culling.
+    // Rebuilt when the player enters another chunk, the view distance
+    // changes or chunks are loaded or unloaded.
+    RenderRegions m_renderRegions;
+    glm::ivec2 m_regionChunk;
+    float m_regionViewDistance;
+    // The meshes drawn this frame, submitted with one call per pass
+    MeshArena::DrawList m_opaqueDraws;
+    MeshArena::DrawList m_transparentDraws;
+    // Whether to use multi-draw calls, or a draw call per mesh for comparison
+    bool m_multiDraw;
+    // The visible chunks with their distance to the player, closest first.
+    // Scheduling, uploading and drawing all go by this order.
+    std::vector<std::pair<float, Chunk*>> m_drawOrder;
+    OpaqueOrder m_opaqueOrder;
+    // Chunks whose transparent faces were left in an outdated order last
+    // frame, over the sorting budget
+    size_t m_deferredSorts;
+    // Counts the fragments shaded by the opaque pass, while enabled
+    OverdrawMeter m_overdrawMeter;
+    bool m_measureOverdraw;
+    // Draw calls and CPU time spent submitting the chunks, summed over frames
+    uint64_t m_drawCalls;
+    uint64_t m_submittedFrames;
+    uint64_t m_submitNanoseconds;
+    // Meshes waiting to be sent to the GPU with their distance to the
+    // player. Each frame uploads the closest ones up to a byte budget.
+    std::vector<std::pair<float, Chunk*>> m_uploadQueue;
+    // Upload statistics: meshes and bytes sent, time spent uploading, the
+    // slowest frame, frames slower than the stall threshold, and meshes
+    // that were left for the next frame last frame
+    uint64_t m_uploadFrames;
+    uint64_t m_uploadedMeshes;
+    uint64_t m_uploadedBytes;
+    uint64_t m_uploadNanoseconds;
+    uint64_t m_maxUploadNanoseconds;
+    uint64_t m_uploadStalls;
+    size_t m_deferredUploads;
+    // Frames drawn so far, to find the least recently drawn chunks
+    uint64_t m_frame;
+    // Meshes evicted to stay within the GPU memory budget, the passes that
+    // evicted them, and the frame before which no pass is tried again
+    uint64_t m_evictedMeshes;
+    uint64_t m_evictionPasses;
+    uint64_t m_nextEvictionFrame;
+    // Free the GPU data of the least recently drawn chunks
+    void evictGPUData();
+    // Free the previous level of detail meshes cached at least minAge
+    // frames ago, of every resident chunk, drawn or not
+    void expireCachedMeshes(uint64_t minAge);
+    uint64_t m_expiredCachedMeshes;
+    // Meshes uploaded because of level of detail switches per second,
+    // sampled once per second
+    std::chrono::steady_clock::time_point m_lodSampleTime;
+    uint64_t m_lodSampleRemeshes;
+    double m_lodRemeshesPerSecond;
+    // Per-frame list of draw(), kept to reuse its memory
+    std::vector<Chunk*> m_chunksToDraw;
+    // Where the player was and looked at when the job priorities were last updated
+    glm::ivec2 m_scheduledChunk;
+    glm::vec3 m_scheduledForward;
+    float m_scheduledViewDistance;
+    std::array<glm::vec4, 6> m_scheduledFrustum;
+    // Distance of the chunk to the player, pushed back by the view distance
+    // if it's outside the frustum of the last priority update. Jobs queued
+    // between two updates are ranked the same way as the ones already queued.
+    float jobPriority(const Chunk* chunk, glm::vec2 playerXZ) const;
+    // Diff the zones around the previous and the new center zone
+    void moveCenterZone(glm::ivec2 zone, const glm::vec3& playerPosition);
+    // Retry the zones that couldn't be loaded, unloaded or completed yet
+    void processPendingZones(const glm::vec3& playerPosition);
+    // Generate the chunks of a zone that isn't loaded, or load it from disk
+    void loadOrGenerateZone(int zoneX, int zoneZ, const glm::vec3& playerPosition);
+    // Generation stages of chunks in the given zone
+    StageMask stagesForZone(int zoneX, int zoneZ) const;
+    void reserveZone(int64_t key);
+    bool isZoneBusy(int64_t key) const;
+    // Delete the chunks of unloaded zones that are done saving
+    void deleteRetiredZones();
+
     // OpenGL context
     OpenGLContext* mp_context;
 
-    std::vector<Rivers> m_allRivers;
+    // Read by the generation workers while new rivers are added
+    RiverRegistry m_allRivers;
+    // Zones whose river has already been decided (and created, if they have one)
+    std::unordered_set<int64_t> m_riverZones;
+    // Create the river of every zone within RIVER_ZONE_REACH of the given zone
+    // that hasn't been decided yet, so that every river that can cross the
+    // zone exists before it is generated
+    void registerRiversAround(int zoneX, int zoneZ);
+    // Create the river that starts in the given zone, if the zone has one.
+    // Whether there is a river and its parameters only depend on the world
+    // seed and the zone coordinates.
     void createNewRiver(int zoneX, int zoneZ);
 
+    // Per-zone height/biome tiles shared by generation,
+    // serialization and reloading of chunks
+    NoiseTileCache m_noiseTileCache;
+    // The staged world generator used by every Chunk
+    GenerationPipeline m_pipeline;
+
+    // Zones further away from the player than this (in zones) are generated
+    // without caves, which are carved in once the player comes closer
+    int m_caveDistance;
+    // Generated zones whose chunks are still missing some generation stages
+    std::unordered_set<int64_t> m_incompleteZones;
+    // Run the missing generation stages of a zone if all its chunks are ready
+    bool completeZone(int zoneX, int zoneZ, const glm::vec3& playerPosition);
+    // Chunks whose generation was cancelled because their zone left the
+    // generation distance before it started. Rescheduled when it comes back.
+    std::unordered_set<const Chunk*> m_deferredChunks;
+    // Queue the generation of the chunk, closest chunks first
+    void scheduleGeneration(Chunk* chunk, StageMask stages, const glm::vec3& playerPosition);
+    // A chunk is only meshed once it and all of its neighbors that are
+    // going to be generated have block data, since the faces along its
+    // borders depend on them. Once a neighbor finishes generating, it
+    // flags the chunk for an update again.
+    bool isReadyToMesh(const Chunk* chunk) const;
+
+    // Threads for all background work of the terrain, and the scheduler of
+    // the generation and meshing jobs. Declared after all the data the jobs
+    // use, so that they are destroyed (and their jobs finished) first.
+    WorkStealingPool m_workerPool;
+    ChunkScheduler m_scheduler;
+
 public:
     Terrain(OpenGLContext *context);
     ~Terrain();
 
     // Instantiates a new Chunk and stores it in
     // our chunk map at the given coordinates.
-    // Returns a pointer to the created Chunk.
+    // Returns a pointer to the created Chunk, or to the Chunk
+    // another thread created there at the same time.
     Chunk* instantiateChunkAt(int x, int z);
     // Do these world-space coordinates lie within
     // a Chunk that exists?
     bool hasChunkAt(int x, int z) const;
-    // Assuming a Chunk exists at these coords,
-    // return a mutable reference to it
-    uPtr<Chunk>& getChunkAt(int x, int z);
-    // Assuming a Chunk exists at these coords,
-    // return a const reference to it
-    const uPtr<Chunk>& getChunkAt(int x, int z) const;
+    // Return the Chunk at these coords (nullptr if there is none)
+    Chunk* getChunkAt(int x, int z);
+    const Chunk* getChunkAt(int x, int z) const;
     // Given a world-space coordinate (which may have negative
     // values) return the block stored at that point in space.
     BlockType getGlobalBlockAt(int x, int y, int z) const;
@@ -86,7 +266,9 @@ public:
     void setGlobalBlockAt(int x, int y, int z, BlockType t);
 
     // Draws every Chunk within a given range of the player.
-    void draw(const glm::vec3 &playerPosition, ShaderProgram *shaderProgram, ShaderProgram *shaderProgramBlinnPhong, const Camera& camera);
+    // shaderProgramDepth only writes depth, for the depth prepass.
+    void draw(const glm::vec3 &playerPosition, ShaderProgram *shaderProgram, ShaderProgram *shaderProgramBlinnPhong,
+              ShaderProgram *shaderProgramDepth, const Camera& camera);
     // Generate new chunks when the plyer moves between chunks
     void generate(const glm::vec3 &playerPosition);
 
@@ -94,15 +276,48 @@ public:
     std::string m_worldFolder; // Save/load folder
     // Check whether a zone file exists within the worldFolder
     bool zoneFileExists(int zoneX, int zoneZ);
-    // Save a zone to disk when it is no longer within
-    // the player's generation distance
-    void unloadZone(int zoneX, int zoneZ);
+    // Remove a zone that is no longer within the player's generation
+    // distance from the world, and save it to disk if it was modified.
+    // Returns false if the zone can't be unloaded yet because jobs
+    // still use its chunks.
+    bool unloadZone(int zoneX, int zoneZ);
     // Save one terrain zone to disk
     void saveZone(int zoneX, int zoneZ);
+    // Write the given chunks of a zone to its zone file
+    void writeZone(int zoneX, int zoneZ, const std::vector<Chunk*>& chunks);
+    // Called by the save and load jobs once they are done with the zone
+    void releaseZone(int zoneX, int zoneZ);
     // Load one terrain zone from disk
     void loadZone(int zoneX, int zoneZ);
     // Save the entire world to disk (used when the player quits the game
     // or manually triggered using Ctrl+S)
     void saveTerrain();
+    // Block until all background jobs (generation, meshing, saving, loading) are done
+    void waitForWorkers();
+
+    // --- Distances ---
+    // Set the radius of the square of zones kept loaded around the
+    // player's zone (clamped to [1, 10]), applied on the next generate()
+    void setGenerationDistance(int zones);
+    int getGenerationDistance() const;
+    // Set the distance up to which chunks are drawn, in blocks
+    void setViewDistance(float distance);
+    float getViewDistance() const;
+
+    // Draw the chunks with one multi-draw call per pass (the default),
+    // or with one draw call per mesh to compare the submission cost
+    void setMultiDraw(bool multiDraw);
+    bool isMultiDraw() const;
+    // Order the opaque chunks are drawn in (front to back by default)
+    void setOpaqueOrder(OpaqueOrder order);
+    OpaqueOrder getOpaqueOrder() const;
+    // Measure the fragments shaded per pixel by the opaque pass, for F3
+    void setMeasureOverdraw(bool measure);
+    bool isMeasuringOverdraw() const;
 
+    // --- Statistics ---
+    const NoiseTileCache& getNoiseTileCache() const;
+    GenerationPipeline& getPipeline();
+    // Print the performance counters of the terrain systems
+    void printStats(std::ostream& os) const;
 };
@@ -5,18 +5,24 @@ VBOWorker::VBOWorker(Chunk* chunk)
     : m_chunk(chunk)
 {}
 
+void VBOWorker::setChunk(Chunk* chunk) {
+    m_chunk = chunk;
+}
+
 void VBOWorker::run()
 {
+    // Skip chunks that are being (re)generated or already meshed by someone else,
+    // and chunks that got their cached mesh back while the job was queued
+    if (!m_chunk->needsUpdate() || !m_chunk->beginMeshing()) {
+        return;
+    }
     try {
-        if (m_chunk->needsUpdate() && m_chunk->hasBlockData()) {
-                // Generate VBO data for the chunk
-                m_chunk->createVBOdata();
-                // Mark the chunk as having VBO data ready
-                m_chunk->setHasVBOData(true);
-                m_chunk->setNeedsUpdate(false);
-        }
+        // Generate VBO data for the chunk
+        m_chunk->createVBOdata();
+        // Mark the chunk as having VBO data ready (unless it is already outdated)
+        m_chunk->finishMeshing();
     } catch (const std::exception& e) {
         std::cerr << "Error generating VBO data for chunk: " << e.what() << std::endl;
+        m_chunk->abortMeshing();
     }
-    
 }
@@ -8,6 +8,8 @@ class VBOWorker : public QRunnable
 {
 public:
     VBOWorker(Chunk* chunk);
+    // Reuse the worker for another chunk
+    void setChunk(Chunk* chunk);
     void run() override;
 
 private:
@@ -0,0 +1,169 @@
+#include "workstealingpool.h"
+#include <algorithm>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+// Index of the pool worker running on this thread (-1 on other threads)
+static thread_local int currentWorker = -1;
+// Pool the current worker belongs to, a thread might submit to other pools
+static thread_local const WorkStealingPool* currentPool = nullptr;
+
+WorkStealingPool::WorkStealingPool(int threadCount, bool pinThreads)
+    : m_workers(), m_queued(0), m_pending(0), m_nextWorker(0), m_stopping(false),
+    m_sleepMutex(), m_jobsQueued(), m_allDone(), m_executed(0), m_stolen(0)
+{
+    threadCount = std::max(threadCount, 1);
+    for (int i = 0; i < threadCount; ++i) {
+        m_workers.push_back(mkU<Worker>());
+    }
+    // Start the threads only once all deques exist, since they steal from each other
+    for (int i = 0; i < threadCount; ++i) {
+        m_workers[i]->thread = std::thread(&WorkStealingPool::run, this, i, pinThreads);
+    }
+}
+
+WorkStealingPool::~WorkStealingPool() {
+    waitForDone();
+    {
+        std::lock_guard<std::mutex> lock(m_sleepMutex);
+        m_stopping = true;
+    }
+    m_jobsQueued.notify_all();
+    for (uPtr<Worker>& worker : m_workers) {
+        worker->thread.join();
+    }
+}
+
+void WorkStealingPool::start(QRunnable* job) {
+    int index = currentPool == this ? currentWorker
+                                    : static_cast<int>(m_nextWorker++ % m_workers.size());
+    Worker& worker = *m_workers[index];
+    m_pending++;
+    {
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        worker.jobs.push_back(job);
+    }
+    m_queued++;
+    notifyQueued(1);
+}
+
+void WorkStealingPool::startBatch(const std::vector<QRunnable*>& jobs) {
+    if (jobs.empty()) {
+        return;
+    }
+    m_pending += static_cast<int>(jobs.size());
+    // Hand every worker a contiguous slice of the batch
+    size_t workers = m_workers.size();
+    size_t first = m_nextWorker++;
+    for (size_t w = 0; w < workers; ++w) {
+        size_t begin = jobs.size() * w / workers;
+        size_t end = jobs.size() * (w + 1) / workers;
+        if (begin == end) {
+            continue;
+        }
+        Worker& worker = *m_workers[(first + w) % workers];
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        worker.jobs.insert(worker.jobs.end(), jobs.begin() + begin, jobs.begin() + end);
+    }
+    m_queued += static_cast<int>(jobs.size());
+    notifyQueued(static_cast<int>(jobs.size()));
+}
+
+void WorkStealingPool::notifyQueued(int count) {
+    // Taking the lock orders this after a worker that just found no jobs
+    // and is about to sleep, so it can't miss the notification
+    {
+        std::lock_guard<std::mutex> lock(m_sleepMutex);
+    }
+    if (count == 1) {
+        m_jobsQueued.notify_one();
+    } else {
+        m_jobsQueued.notify_all();
+    }
+}
+
+void WorkStealingPool::waitForDone() {
+    std::unique_lock<std::mutex> lock(m_sleepMutex);
+    m_allDone.wait(lock, [this]() { return m_pending == 0; });
+}
+
+int WorkStealingPool::threadCount() const {
+    return static_cast<int>(m_workers.size());
+}
+
+uint64_t WorkStealingPool::getExecutedCount() const {
+    return m_executed;
+}
+
+uint64_t WorkStealingPool::getStolenCount() const {
+    return m_stolen;
+}
+
+QRunnable* WorkStealingPool::takeJob(int index) {
+    {
+        Worker& own = *m_workers[index];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.jobs.empty()) {
+            QRunnable* job = own.jobs.back();
+            own.jobs.pop_back();
+            m_queued--;
+            return job;
+        }
+    }
+    // Steal the oldest job of the next worker that has one
+    int workers = static_cast<int>(m_workers.size());
+    for (int i = 1; i < workers; ++i) {
+        Worker& victim = *m_workers[(index + i) % workers];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.jobs.empty()) {
+            QRunnable* job = victim.jobs.front();
+            victim.jobs.pop_front();
+            m_queued--;
+            m_stolen++;
+            return job;
+        }
+    }
+    return nullptr;
+}
+
+void WorkStealingPool::finishJob(QRunnable* job) {
+    if (job->autoDelete()) {
+        delete job;
+    }
+    m_executed++;
+    if (--m_pending == 0) {
+        std::lock_guard<std::mutex> lock(m_sleepMutex);
+        m_allDone.notify_all();
+    }
+}
+
+void WorkStealingPool::run(int index, bool pin) {
+    currentWorker = index;
+    currentPool = this;
+#ifdef __linux__
+    if (pin) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(index % std::max(1u, std::thread::hardware_concurrency()), &cpus);
+        pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    }
+#else
+    (void)pin;
+#endif
+
+    while (true) {
+        QRunnable* job = takeJob(index);
+        if (job) {
+            job->run();
+            finishJob(job);
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(m_sleepMutex);
+        m_jobsQueued.wait(lock, [this]() { return m_stopping || m_queued > 0; });
+        if (m_stopping && m_queued == 0) {
+            return;
+        }
+    }
+}
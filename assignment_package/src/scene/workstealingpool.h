@@ -0,0 +1,81 @@
+#ifndef WORKSTEALINGPOOL_H
+#define WORKSTEALINGPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <QRunnable>
+#include <QThread>
+#include "../smartpointerhelp.h"
+
+// A fixed size thread pool for the terrain's background work
+// (generation, meshing, saving and loading).
+//
+// Every worker thread has its own job deque. Jobs submitted from a worker
+// go to the back of its own deque and are taken from there again (LIFO),
+// so follow-up work tends to run on the thread whose cache already holds
+// its data. Jobs from other threads are spread over the deques round-robin.
+// An idle worker steals from the front of the other deques.
+//
+// Jobs are QRunnables, like with QThreadPool. Jobs with autoDelete() set
+// are deleted after they ran, others can be submitted again once they
+// are done, which avoids an allocation per job.
+class WorkStealingPool {
+public:
+    // If pinThreads is set, worker i is pinned to core i (Linux only)
+    WorkStealingPool(int threadCount = QThread::idealThreadCount(), bool pinThreads = false);
+    // Runs all submitted jobs, then stops the workers
+    ~WorkStealingPool();
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+    void start(QRunnable* job);
+    // Submit many jobs while taking every deque's lock only once
+    void startBatch(const std::vector<QRunnable*>& jobs);
+
+    // Block until every submitted job has finished
+    void waitForDone();
+
+    int threadCount() const;
+
+    // --- Statistics ---
+    uint64_t getExecutedCount() const;
+    // Number of jobs that ran on a different worker than they were queued on
+    uint64_t getStolenCount() const;
+
+private:
+    struct Worker {
+        std::mutex mutex;
+        std::deque<QRunnable*> jobs;
+        std::thread thread;
+    };
+
+    void run(int index, bool pin);
+    // Take a job from the worker's own deque, or steal one
+    QRunnable* takeJob(int index);
+    void finishJob(QRunnable* job);
+    // Wake a sleeping worker after jobs were queued
+    void notifyQueued(int count);
+
+    std::vector<uPtr<Worker>> m_workers;
+
+    // Jobs in the deques, and jobs in the deques or running
+    std::atomic<int> m_queued;
+    std::atomic<int> m_pending;
+    std::atomic<unsigned int> m_nextWorker;
+    bool m_stopping;
+
+    // Protects m_stopping and the sleeping/waiting on the conditions
+    std::mutex m_sleepMutex;
+    std::condition_variable m_jobsQueued;
+    std::condition_variable m_allDone;
+
+    std::atomic<uint64_t> m_executed;
+    std::atomic<uint64_t> m_stolen;
+};
+
+#endif // WORKSTEALINGPOOL_H
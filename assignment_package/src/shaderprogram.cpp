@@ -1,17 +1,26 @@
 #include "shaderprogram.h"
+#include "frameuniforms.h"
 #include <QFile>
 #include <QDebug>
 #include <QTextStream>
 #include <QStringBuilder>
 #include <iostream>
 #include <exception>
+#include <cstring>
 #include <QDir>
 
+// The names of the VertexAttributes in the shaders
+static const std::array<const char*, ATTRIB_COUNT> ATTRIB_NAMES = {
+    "vs_Pos", "vs_Nor", "vs_Col", "vs_UV", "vs_Animated",
+    "vs_ColInstanced", "vs_OffsetInstanced"
+};
 
 ShaderProgram::ShaderProgram(OpenGLContext *context)
     : vertShader(), fragShader(), prog(),
       context(context), m_isReloading(true)
-{}
+{
+    m_attribLocations.fill(-1);
+}
 
 void ShaderProgram::destroy() {
     context->glDeleteProgram(prog);
@@ -19,6 +28,9 @@ void ShaderProgram::destroy() {
     context->glDeleteShader(fragShader);
     m_attribs.clear();
     m_unifs.clear();
+    m_attribLocations.fill(-1);
+    m_uniformSlots.clear();
+    m_uniformHandles.clear();
 }
 
 void ShaderProgram::create(const char *vertfile, const char *fragfile)
@@ -56,6 +68,11 @@ void ShaderProgram::create(const char *vertfile, const char *fragfile)
     // Tell prog that it manages these particular vertex and fragment shaders
     context->glAttachShader(prog, vertShader);
     context->glAttachShader(prog, fragShader);
+    // Give the attributes the same locations in every program. Names the
+    // shaders don't declare are ignored.
+    for (int i = 0; i < ATTRIB_COUNT; ++i) {
+        context->glBindAttribLocation(prog, i, ATTRIB_NAMES[i]);
+    }
     context->glLinkProgram(prog);
 
     // Check for linking success
@@ -66,6 +83,15 @@ void ShaderProgram::create(const char *vertfile, const char *fragfile)
     }
 
     parseShaderSourceForVariables(vertSource, fragSource);
+    // Resolve the attributes once, so drawing doesn't look them up by name
+    for (int i = 0; i < ATTRIB_COUNT; ++i) {
+        m_attribLocations[i] = context->glGetAttribLocation(prog, ATTRIB_NAMES[i]);
+    }
+    // Read the camera and the time from the shared uniform buffer
+    GLuint frameUniforms = context->glGetUniformBlockIndex(prog, "FrameUniforms");
+    if (frameUniforms != GL_INVALID_INDEX) {
+        context->glUniformBlockBinding(prog, frameUniforms, FRAME_UNIFORMS_BINDING);
+    }
     delete[] vertSource;
     delete[] fragSource;
 
@@ -103,79 +129,91 @@ void ShaderProgram::useMe() {
     context->glUseProgram(prog);
 }
 
-void ShaderProgram::setUnifMat4(std::string name, const glm::mat4 &m) {
-    useMe();
-    try {
-        int handle = m_unifs.at(name);
-        if(handle != -1) {
-            context->glUniformMatrix4fv(handle, 1, GL_FALSE, &m[0][0]);
-        }
+int ShaderProgram::getUniformHandle(const std::string &name) {
+    auto handle = m_uniformHandles.find(name);
+    if (handle != m_uniformHandles.end()) {
+        return handle->second;
     }
-    catch(std::out_of_range &e) {
+    auto location = m_unifs.find(name);
+    if (location == m_unifs.end()) {
         std::cout << "Error: could not find shader variable with name " << name << std::endl;
     }
-}
-void ShaderProgram::setUnifVec2(std::string name, const glm::vec2 &v) {
-    useMe();
-    try {
-        int handle = m_unifs.at(name);
-        if(handle != -1) {
-            context->glUniform2fv(handle, 1, &v[0]);
-        }
-    }
-    catch(std::out_of_range &e) {
-        std::cout << "Error: could not find shader variable with name " << name << std::endl;
+    int h = -1;
+    if (location != m_unifs.end() && location->second != -1) {
+        h = static_cast<int>(m_uniformSlots.size());
+        m_uniformSlots.push_back(UniformSlot{location->second, {}, 0});
     }
+    m_uniformHandles[name] = h;
+    return h;
 }
-void ShaderProgram::setUnifVec3(std::string name, const glm::vec3 &v) {
-    useMe();
-    try {
-        int handle = m_unifs.at(name);
-        if(handle != -1) {
-            context->glUniform3fv(handle, 1, &v[0]);
-        }
-    }
-    catch(std::out_of_range &e) {
-        std::cout << "Error: could not find shader variable with name " << name << std::endl;
+
+bool ShaderProgram::updateUniformValue(int handle, const void *value, size_t size) {
+    UniformSlot &slot = m_uniformSlots[handle];
+    if (slot.size == size && std::memcmp(slot.value.data(), value, size) == 0) {
+        return false;
     }
+    std::memcpy(slot.value.data(), value, size);
+    slot.size = size;
+    return true;
 }
-void ShaderProgram::setUnifFloat(std::string name, float f) {
-    useMe();
-    try {
-        int handle = m_unifs.at(name);
-        if(handle != -1) {
-            context->glUniform1f(handle, f);
-        }
+
+void ShaderProgram::setUnifMat4(int handle, const glm::mat4 &m) {
+    if (handle != -1 && updateUniformValue(handle, &m, sizeof(m))) {
+        useMe();
+        context->glUniformMatrix4fv(m_uniformSlots[handle].location, 1, GL_FALSE, &m[0][0]);
     }
-    catch(std::out_of_range &e) {
-        std::cout << "Error: could not find shader variable with name " << name << std::endl;
+}
+void ShaderProgram::setUnifVec2(int handle, const glm::vec2 &v) {
+    if (handle != -1 && updateUniformValue(handle, &v, sizeof(v))) {
+        useMe();
+        context->glUniform2fv(m_uniformSlots[handle].location, 1, &v[0]);
     }
 }
-void ShaderProgram::setUnifInt(std::string name, int i) {
-    useMe();
-    try {
-        int handle = m_unifs.at(name);
-        if(handle != -1) {
-            context->glUniform1i(handle, i);
-        }
+void ShaderProgram::setUnifVec3(int handle, const glm::vec3 &v) {
+    if (handle != -1 && updateUniformValue(handle, &v, sizeof(v))) {
+        useMe();
+        context->glUniform3fv(m_uniformSlots[handle].location, 1, &v[0]);
     }
-    catch(std::out_of_range &e) {
-        std::cout << "Error: could not find shader variable with name " << name << std::endl;
+}
+void ShaderProgram::setUnifFloat(int handle, float f) {
+    if (handle != -1 && updateUniformValue(handle, &f, sizeof(f))) {
+        useMe();
+        context->glUniform1f(m_uniformSlots[handle].location, f);
     }
 }
-void ShaderProgram::setUnifArrayInt(std::string name, int offset, int i) {
-    useMe();
-    try {
-        int handle = m_unifs.at(name);
-        if(handle != -1) {
-            context->glUniform1i(handle + offset, i);
-        }
+void ShaderProgram::setUnifInt(int handle, int i) {
+    if (handle != -1 && updateUniformValue(handle, &i, sizeof(i))) {
+        useMe();
+        context->glUniform1i(m_uniformSlots[handle].location, i);
     }
-    catch(std::out_of_range &e) {
-        std::cout << "Error: could not find shader variable with name " << name << std::endl;
+}
+void ShaderProgram::setUnifArrayInt(int handle, int offset, int i) {
+    // The slot only remembers the first element, so array elements are always set
+    if (handle != -1) {
+        useMe();
+        context->glUniform1i(m_uniformSlots[handle].location + offset, i);
     }
 }
 
+void ShaderProgram::setUnifMat4(const std::string &name, const glm::mat4 &m) {
+    setUnifMat4(getUniformHandle(name), m);
+}
+void ShaderProgram::setUnifVec2(const std::string &name, const glm::vec2 &v) {
+    setUnifVec2(getUniformHandle(name), v);
+}
+void ShaderProgram::setUnifVec3(const std::string &name, const glm::vec3 &v) {
+    setUnifVec3(getUniformHandle(name), v);
+}
+void ShaderProgram::setUnifFloat(const std::string &name, float f) {
+    setUnifFloat(getUniformHandle(name), f);
+}
+void ShaderProgram::setUnifInt(const std::string &name, int i) {
+    setUnifInt(getUniformHandle(name), i);
+}
+void ShaderProgram::setUnifArrayInt(const std::string &name, int offset, int i) {
+    setUnifArrayInt(getUniformHandle(name), offset, i);
+}
+
 
 //This function, as its name implies, uses the passed in GL widget
 void ShaderProgram::draw(Drawable &d) {
@@ -187,22 +225,22 @@ void ShaderProgram::draw(Drawable &d) {
     useMe();
 
     int handle;
-    if ((handle = m_attribs["vs_Pos"]) != -1 && d.bindBuffer(POSITION)) {
+    if ((handle = m_attribLocations[ATTRIB_POS]) != -1 && d.bindBuffer(POSITION)) {
         context->glEnableVertexAttribArray(handle);
         context->glVertexAttribPointer(handle, 4, GL_FLOAT, false, 0, nullptr);
     }
 
-    if ((handle = m_attribs["vs_Nor"]) != -1 && d.bindBuffer(NORMAL)) {
+    if ((handle = m_attribLocations[ATTRIB_NOR]) != -1 && d.bindBuffer(NORMAL)) {
         context->glEnableVertexAttribArray(handle);
         context->glVertexAttribPointer(handle, 4, GL_FLOAT, false, 0, nullptr);
     }
 
-    if ((handle = m_attribs["vs_Col"]) != -1 && d.bindBuffer(COLOR)) {
+    if ((handle = m_attribLocations[ATTRIB_COL]) != -1 && d.bindBuffer(COLOR)) {
         context->glEnableVertexAttribArray(handle);
         context->glVertexAttribPointer(handle, 4, GL_FLOAT, false, 0, nullptr);
     }
 
-    if ((handle = m_attribs["vs_UV"]) != -1 && d.bindBuffer(UV)) {
+    if ((handle = m_attribLocations[ATTRIB_UV]) != -1 && d.bindBuffer(UV)) {
         context->glEnableVertexAttribArray(handle);
         context->glVertexAttribPointer(handle, 2, GL_FLOAT, false, 0, nullptr);
     }
@@ -212,12 +250,12 @@ void ShaderProgram::draw(Drawable &d) {
     d.bindBuffer(INDEX);
     context->glDrawElements(d.drawMode(), d.elemCount(INDEX), GL_UNSIGNED_INT, 0);
 
-    if (m_attribs["vs_Pos"] != -1) context->glDisableVertexAttribArray(m_attribs["vs_Pos"]);
-    if (m_attribs["vs_Nor"] != -1) context->glDisableVertexAttribArray(m_attribs["vs_Nor"]);
-    if (m_attribs["vs_Col"] != -1) context->glDisableVertexAttribArray(m_attribs["vs_Col"]);
-    if (m_attribs["vs_UV"] != -1) context->glDisableVertexAttribArray(m_attribs["vs_UV"]);
+    if (m_attribLocations[ATTRIB_POS] != -1) context->glDisableVertexAttribArray(m_attribLocations[ATTRIB_POS]);
+    if (m_attribLocations[ATTRIB_NOR] != -1) context->glDisableVertexAttribArray(m_attribLocations[ATTRIB_NOR]);
+    if (m_attribLocations[ATTRIB_COL] != -1) context->glDisableVertexAttribArray(m_attribLocations[ATTRIB_COL]);
+    if (m_attribLocations[ATTRIB_UV] != -1) context->glDisableVertexAttribArray(m_attribLocations[ATTRIB_UV]);
 
-    context->printGLErrorLog();
+    context->checkGLErrors();
 }
 
 // Draws a Drawable that was setup with an interleaved vertex buffer.
@@ -232,27 +270,27 @@ void ShaderProgram::drawInterleaved(Drawable &d) {
     size_t stride = 3 * sizeof(glm::vec4) + sizeof(glm::vec2) + sizeof(float);
 
     int handle;
-    if ((handle = m_attribs["vs_Pos"]) != -1 && d.bindBuffer(INTERLEAVED)) {
+    if ((handle = m_attribLocations[ATTRIB_POS]) != -1 && d.bindBuffer(INTERLEAVED)) {
         context->glEnableVertexAttribArray(handle);
         context->glVertexAttribPointer(handle, 4, GL_FLOAT, false, stride, (void*)0);
     }
 
-    if ((handle = m_attribs["vs_Nor"]) != -1 && d.bindBuffer(INTERLEAVED)) {
+    if ((handle = m_attribLocations[ATTRIB_NOR]) != -1 && d.bindBuffer(INTERLEAVED)) {
         context->glEnableVertexAttribArray(handle);
         context->glVertexAttribPointer(handle, 4, GL_FLOAT, false, stride, (void*)sizeof(glm::vec4));
     }
 
-    if ((handle = m_attribs["vs_Col"]) != -1 && d.bindBuffer(INTERLEAVED)) {
+    if ((handle = m_attribLocations[ATTRIB_COL]) != -1 && d.bindBuffer(INTERLEAVED)) {
         context->glEnableVertexAttribArray(handle);
         context->glVertexAttribPointer(handle, 4, GL_FLOAT, false, stride, (void*)(2 * sizeof(glm::vec4)));
     }
 
-    if ((handle = m_attribs["vs_UV"]) != -1 && d.bindBuffer(INTERLEAVED)) {
+    if ((handle = m_attribLocations[ATTRIB_UV]) != -1 && d.bindBuffer(INTERLEAVED)) {
         context->glEnableVertexAttribArray(handle);
         context->glVertexAttribPointer(handle, 2, GL_FLOAT, false, stride, (void*)(3 * sizeof(glm::vec4)));
     }
 
-    if ((handle = m_attribs["vs_Animated"]) != -1 && d.bindBuffer(INTERLEAVED)) {
+    if ((handle = m_attribLocations[ATTRIB_ANIMATED]) != -1 && d.bindBuffer(INTERLEAVED)) {
         context->glEnableVertexAttribArray(handle);
         context->glVertexAttribPointer(handle, 1, GL_FLOAT, false, stride, (void*)(3 * sizeof(glm::vec4) + sizeof(glm::vec2)));
     }
@@ -262,12 +300,12 @@ void ShaderProgram::drawInterleaved(Drawable &d) {
     d.bindBuffer(INDEX);
     context->glDrawElements(d.drawMode(), d.elemCount(INDEX), GL_UNSIGNED_INT, 0);
 
-    if (m_attribs["vs_Pos"] != -1) context->glDisableVertexAttribArray(m_attribs["vs_Pos"]);
-    if (m_attribs["vs_Nor"] != -1) context->glDisableVertexAttribArray(m_attribs["vs_Nor"]);
-    if (m_attribs["vs_Col"] != -1) context->glDisableVertexAttribArray(m_attribs["vs_Col"]);
-    if (m_attribs["vs_UV"] != -1) context->glDisableVertexAttribArray(m_attribs["vs_UV"]);
+    if (m_attribLocations[ATTRIB_POS] != -1) context->glDisableVertexAttribArray(m_attribLocations[ATTRIB_POS]);
+    if (m_attribLocations[ATTRIB_NOR] != -1) context->glDisableVertexAttribArray(m_attribLocations[ATTRIB_NOR]);
+    if (m_attribLocations[ATTRIB_COL] != -1) context->glDisableVertexAttribArray(m_attribLocations[ATTRIB_COL]);
+    if (m_attribLocations[ATTRIB_UV] != -1) context->glDisableVertexAttribArray(m_attribLocations[ATTRIB_UV]);
 
-    context->printGLErrorLog();
+    context->checkGLErrors();
 }
 
 // Draws a Drawable that was setup with an interleaved vertex buffer.
@@ -282,27 +320,27 @@ void ShaderProgram::drawInterleavedTransparent(Drawable &d) {
     size_t stride = 3 * sizeof(glm::vec4) + sizeof(glm::vec2) + sizeof(float);
 
     int handle;
-    if ((handle = m_attribs["vs_Pos"]) != -1 && d.bindBuffer(INTERLEAVED_TRANSPARENT)) {
+    if ((handle = m_attribLocations[ATTRIB_POS]) != -1 && d.bindBuffer(INTERLEAVED_TRANSPARENT)) {
         context->glEnableVertexAttribArray(handle);
         context->glVertexAttribPointer(handle, 4, GL_FLOAT, false, stride, (void*)0);
     }
 
-    if ((handle = m_attribs["vs_Nor"]) != -1 && d.bindBuffer(INTERLEAVED_TRANSPARENT)) {
+    if ((handle = m_attribLocations[ATTRIB_NOR]) != -1 && d.bindBuffer(INTERLEAVED_TRANSPARENT)) {
         context->glEnableVertexAttribArray(handle);
         context->glVertexAttribPointer(handle, 4, GL_FLOAT, false, stride, (void*)sizeof(glm::vec4));
     }
 
-    if ((handle = m_attribs["vs_Col"]) != -1 && d.bindBuffer(INTERLEAVED_TRANSPARENT)) {
+    if ((handle = m_attribLocations[ATTRIB_COL]) != -1 && d.bindBuffer(INTERLEAVED_TRANSPARENT)) {
         context->glEnableVertexAttribArray(handle);
         context->glVertexAttribPointer(handle, 4, GL_FLOAT, false, stride, (void*)(2 * sizeof(glm::vec4)));
     }
 
-    if ((handle = m_attribs["vs_UV"]) != -1 && d.bindBuffer(INTERLEAVED_TRANSPARENT)) {
+    if ((handle = m_attribLocations[ATTRIB_UV]) != -1 && d.bindBuffer(INTERLEAVED_TRANSPARENT)) {
         context->glEnableVertexAttribArray(handle);
         context->glVertexAttribPointer(handle, 2, GL_FLOAT, false, stride, (void*)(3 * sizeof(glm::vec4)));
     }
 
-    if ((handle = m_attribs["vs_Animated"]) != -1 && d.bindBuffer(INTERLEAVED_TRANSPARENT)) {
+    if ((handle = m_attribLocations[ATTRIB_ANIMATED]) != -1 && d.bindBuffer(INTERLEAVED_TRANSPARENT)) {
         context->glEnableVertexAttribArray(handle);
         context->glVertexAttribPointer(handle, 1, GL_FLOAT, false, stride, (void*)(3 * sizeof(glm::vec4) + sizeof(glm::vec2)));
     }
@@ -312,15 +350,59 @@ void ShaderProgram::drawInterleavedTransparent(Drawable &d) {
     d.bindBuffer(INDEX_TRANSPARENT);
     context->glDrawElements(d.drawMode(), d.elemCount(INDEX_TRANSPARENT), GL_UNSIGNED_INT, 0);
 
-    if (m_attribs["vs_Pos"] != -1) context->glDisableVertexAttribArray(m_attribs["vs_Pos"]);
-    if (m_attribs["vs_Nor"] != -1) context->glDisableVertexAttribArray(m_attribs["vs_Nor"]);
-    if (m_attribs["vs_Col"] != -1) context->glDisableVertexAttribArray(m_attribs["vs_Col"]);
-    if (m_attribs["vs_UV"] != -1) context->glDisableVertexAttribArray(m_attribs["vs_UV"]);
+    if (m_attribLocations[ATTRIB_POS] != -1) context->glDisableVertexAttribArray(m_attribLocations[ATTRIB_POS]);
+    if (m_attribLocations[ATTRIB_NOR] != -1) context->glDisableVertexAttribArray(m_attribLocations[ATTRIB_NOR]);
+    if (m_attribLocations[ATTRIB_COL] != -1) context->glDisableVertexAttribArray(m_attribLocations[ATTRIB_COL]);
+    if (m_attribLocations[ATTRIB_UV] != -1) context->glDisableVertexAttribArray(m_attribLocations[ATTRIB_UV]);
 
-    context->printGLErrorLog();
+    context->checkGLErrors();
 }
 
 
+void ShaderProgram::drawArena(MeshArena &arena, const MeshArena::DrawList &draws, bool multiDraw) {
+    bool formatOutdated;
+    if (draws.size() == 0 || !arena.bind(formatOutdated)) {
+        return;
+    }
+    useMe();
+
+    // The arena's vertex array object keeps the attribute setup. It uses
+    // the fixed locations rather than this program's, so that it is valid
+    // for every program that draws the arena.
+    if (formatOutdated) {
+        size_t stride = 3 * sizeof(glm::vec4) + sizeof(glm::vec2) + sizeof(float);
+
+        context->glEnableVertexAttribArray(ATTRIB_POS);
+        context->glVertexAttribPointer(ATTRIB_POS, 4, GL_FLOAT, false, stride, (void*)0);
+
+        context->glEnableVertexAttribArray(ATTRIB_NOR);
+        context->glVertexAttribPointer(ATTRIB_NOR, 4, GL_FLOAT, false, stride, (void*)sizeof(glm::vec4));
+
+        context->glEnableVertexAttribArray(ATTRIB_COL);
+        context->glVertexAttribPointer(ATTRIB_COL, 4, GL_FLOAT, false, stride, (void*)(2 * sizeof(glm::vec4)));
+
+        context->glEnableVertexAttribArray(ATTRIB_UV);
+        context->glVertexAttribPointer(ATTRIB_UV, 2, GL_FLOAT, false, stride, (void*)(3 * sizeof(glm::vec4)));
+
+        context->glEnableVertexAttribArray(ATTRIB_ANIMATED);
+        context->glVertexAttribPointer(ATTRIB_ANIMATED, 1, GL_FLOAT, false, stride, (void*)(3 * sizeof(glm::vec4) + sizeof(glm::vec2)));
+    }
+
+    GLsizei drawCount = static_cast<GLsizei>(draws.size());
+    if (multiDraw) {
+        context->multiDrawElementsBaseVertex(GL_TRIANGLES, draws.counts.data(), GL_UNSIGNED_INT,
+                                             draws.indexOffsets.data(), drawCount, draws.baseVertices.data());
+    } else {
+        for (GLsizei i = 0; i < drawCount; ++i) {
+            context->multiDrawElementsBaseVertex(GL_TRIANGLES, &draws.counts[i], GL_UNSIGNED_INT,
+                                                 &draws.indexOffsets[i], 1, &draws.baseVertices[i]);
+        }
+    }
+
+    context->bindDefaultVertexArray();
+    context->checkGLErrors();
+}
+
 void ShaderProgram::drawInstanced(InstancedDrawable &d) {
     if(d.elemCount(INDEX) < 0) {
         throw std::invalid_argument(
@@ -330,31 +412,31 @@ void ShaderProgram::drawInstanced(InstancedDrawable &d) {
     useMe();
 
     int handle;
-    if ((handle = m_attribs["vs_Pos"]) != -1 && d.bindBuffer(POSITION)) {
+    if ((handle = m_attribLocations[ATTRIB_POS]) != -1 && d.bindBuffer(POSITION)) {
         context->glEnableVertexAttribArray(handle);
         context->glVertexAttribPointer(handle, 4, GL_FLOAT, false, 0, nullptr);
         context->glVertexAttribDivisor(handle, 0);
     }
 
-    if ((handle = m_attribs["vs_Nor"]) != -1 && d.bindBuffer(NORMAL)) {
+    if ((handle = m_attribLocations[ATTRIB_NOR]) != -1 && d.bindBuffer(NORMAL)) {
         context->glEnableVertexAttribArray(handle);
         context->glVertexAttribPointer(handle, 4, GL_FLOAT, false, 0, nullptr);
         context->glVertexAttribDivisor(handle, 0);
     }
 
-    if ((handle = m_attribs["vs_UV"]) != -1 && d.bindBuffer(UV)) {
+    if ((handle = m_attribLocations[ATTRIB_UV]) != -1 && d.bindBuffer(UV)) {
         context->glEnableVertexAttribArray(handle);
         context->glVertexAttribPointer(handle, 2, GL_FLOAT, false, 0, nullptr);
         context->glVertexAttribDivisor(handle, 0);
     }
 
-    if ((handle = m_attribs["vs_ColInstanced"]) != -1 && d.bindBuffer(COLOR)) {
+    if ((handle = m_attribLocations[ATTRIB_COL_INSTANCED]) != -1 && d.bindBuffer(COLOR)) {
         context->glEnableVertexAttribArray(handle);
         context->glVertexAttribPointer(handle, 3, GL_FLOAT, false, 0, nullptr);
         context->glVertexAttribDivisor(handle, 1);
     }
 
-    if ((handle = m_attribs["vs_OffsetInstanced"]) != -1 && d.bindBuffer(INSTANCED_OFFSET)) {
+    if ((handle = m_attribLocations[ATTRIB_OFFSET_INSTANCED]) != -1 && d.bindBuffer(INSTANCED_OFFSET)) {
         context->glEnableVertexAttribArray(handle);
         context->glVertexAttribPointer(handle, 3, GL_FLOAT, false, 0, nullptr);
         context->glVertexAttribDivisor(handle, 1);
@@ -365,13 +447,13 @@ void ShaderProgram::drawInstanced(InstancedDrawable &d) {
     d.bindBuffer(INDEX);
     context->glDrawElementsInstanced(d.drawMode(), d.elemCount(INDEX), GL_UNSIGNED_INT, 0, d.instanceCount());
 
-    if (m_attribs["vs_Pos"] != -1) context->glDisableVertexAttribArray(m_attribs["vs_Pos"]);
-    if (m_attribs["vs_Nor"] != -1) context->glDisableVertexAttribArray(m_attribs["vs_Nor"]);
-    if (m_attribs["vs_UV"] != -1) context->glDisableVertexAttribArray(m_attribs["vs_UV"]);
-    if (m_attribs["vs_ColInstanced"] != -1) context->glDisableVertexAttribArray(m_attribs["vs_ColInstanced"]);
-    if (m_attribs["vs_OffsetInstanced"] != -1) context->glDisableVertexAttribArray(m_attribs["vs_OffsetInstanced"]);
+    if (m_attribLocations[ATTRIB_POS] != -1) context->glDisableVertexAttribArray(m_attribLocations[ATTRIB_POS]);
+    if (m_attribLocations[ATTRIB_NOR] != -1) context->glDisableVertexAttribArray(m_attribLocations[ATTRIB_NOR]);
+    if (m_attribLocations[ATTRIB_UV] != -1) context->glDisableVertexAttribArray(m_attribLocations[ATTRIB_UV]);
+    if (m_attribLocations[ATTRIB_COL_INSTANCED] != -1) context->glDisableVertexAttribArray(m_attribLocations[ATTRIB_COL_INSTANCED]);
+    if (m_attribLocations[ATTRIB_OFFSET_INSTANCED] != -1) context->glDisableVertexAttribArray(m_attribLocations[ATTRIB_OFFSET_INSTANCED]);
 
-    context->printGLErrorLog();
+    context->checkGLErrors();
 }
 
 char* ShaderProgram::textFileRead(const char* fileName) {
@@ -5,10 +5,22 @@
 #include "glm_includes.h"
 #include <glm/glm.hpp>
 #include "drawable.h"
+#include "scene/mesharena.h"
 #include <unordered_map>
+#include <array>
+#include <vector>
 
 #define dict std::unordered_map
 
+// The vertex attributes the shaders can declare. Every program binds them
+// to these locations before it is linked, so a vertex array object set up
+// for one program can be drawn with any of them.
+enum VertexAttribute : unsigned char {
+    ATTRIB_POS, ATTRIB_NOR, ATTRIB_COL, ATTRIB_UV, ATTRIB_ANIMATED,
+    ATTRIB_COL_INSTANCED, ATTRIB_OFFSET_INSTANCED,
+    ATTRIB_COUNT
+};
+
 
 class ShaderProgram
 {
@@ -19,6 +31,8 @@ public:
 
     dict<std::string, int> m_attribs;
     dict<std::string, int> m_unifs;
+    // The location of each VertexAttribute, -1 if the program doesn't use it
+    std::array<int, ATTRIB_COUNT> m_attribLocations;
 
     bool m_isReloading;
 
@@ -38,17 +52,34 @@ public:
 
     void parseShaderSourceForVariables(char *vertSource, char *fragSource);
 
-    void setUnifMat4(std::string name, const glm::mat4 &m);
-    void setUnifVec2(std::string name, const glm::vec2 &v);
-    void setUnifVec3(std::string name, const glm::vec3 &v);
-    void setUnifFloat(std::string name, float f);
-    void setUnifInt(std::string name, int i);
-    void setUnifArrayInt(std::string name, int offset, int i);
+    // Look a uniform up once, for the setters taking a handle.
+    // Returns -1 (which the setters ignore) if the program doesn't use it.
+    // Handles stay valid until the program is destroyed.
+    int getUniformHandle(const std::string &name);
+
+    // The setters skip the upload if the uniform already has the value
+    void setUnifMat4(int handle, const glm::mat4 &m);
+    void setUnifVec2(int handle, const glm::vec2 &v);
+    void setUnifVec3(int handle, const glm::vec3 &v);
+    void setUnifFloat(int handle, float f);
+    void setUnifInt(int handle, int i);
+    void setUnifArrayInt(int handle, int offset, int i);
+
+    void setUnifMat4(const std::string &name, const glm::mat4 &m);
+    void setUnifVec2(const std::string &name, const glm::vec2 &v);
+    void setUnifVec3(const std::string &name, const glm::vec3 &v);
+    void setUnifFloat(const std::string &name, float f);
+    void setUnifInt(const std::string &name, int i);
+    void setUnifArrayInt(const std::string &name, int offset, int i);
 
     // Draw the given object to our screen using this ShaderProgram's shaders
     void draw(Drawable &d);
     void drawInterleaved(Drawable &d);
     void drawInterleavedTransparent(Drawable &d);
+    // Draw the listed meshes of the arena (interleaved like drawInterleaved)
+    // with a single multi-draw call, or with one draw call per mesh.
+    // The attributes are only specified when the arena's buffers change.
+    void drawArena(MeshArena &arena, const MeshArena::DrawList &draws, bool multiDraw = true);
     void drawInstanced(InstancedDrawable &d);
     // Utility function used in create()
     char* textFileRead(const char*);
@@ -60,6 +91,17 @@ public:
     QString qTextFileRead(const char*);
 
 private:
+    // A uniform returned by getUniformHandle, with the value it was last set to
+    struct UniformSlot {
+        int location;
+        std::array<unsigned char, sizeof(glm::mat4)> value;
+        size_t size; // 0 until the uniform is set
+    };
+    std::vector<UniformSlot> m_uniformSlots;
+    dict<std::string, int> m_uniformHandles;
+    // Remember the value of the uniform, returns false if it already had it
+    bool updateUniformValue(int handle, const void *value, size_t size);
+
     OpenGLContext* context;   // Since Qt's OpenGL support is done through classes like QOpenGLFunctions_3_2_Core,
                             // we need to pass our OpenGL context to the Drawable in order to call GL functions
                             // from within this class.
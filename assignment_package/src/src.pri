@@ -2,13 +2,26 @@ INCLUDEPATH += $$PWD
 DEPENDPATH += $$PWD
 
 SOURCES += \
+    $$PWD/benchmark.cpp \
     $$PWD/framebuffer.cpp \
+    $$PWD/frameuniforms.cpp \
     $$PWD/main.cpp \
     $$PWD/mainwindow.cpp \
     $$PWD/mygl.cpp \
     $$PWD/scene/biomenoise.cpp \
     $$PWD/scene/blocktypeworker.cpp \
+    $$PWD/scene/chunkscheduler.cpp \
+    $$PWD/scene/workstealingpool.cpp \
+    $$PWD/scene/chunkmap.cpp \
+    $$PWD/scene/chunkring.cpp \
+    $$PWD/scene/renderregions.cpp \
+    $$PWD/scene/cullingboxes.cpp \
+    $$PWD/scene/mesharena.cpp \
+    $$PWD/scene/overdrawmeter.cpp \
+    $$PWD/scene/noisetilecache.cpp \
+    $$PWD/scene/generationpipeline.cpp \
     $$PWD/scene/rivers.cpp \
+    $$PWD/scene/riverregistry.cpp \
     $$PWD/scene/saveloadworker.cpp \
     $$PWD/scene/quad.cpp \
     $$PWD/scene/transform.cpp \
@@ -29,18 +42,31 @@ SOURCES += \
     $$PWD/utils.cpp 
 
 HEADERS += \
+    $$PWD/benchmark.h \
     $$PWD/framebuffer.h \
+    $$PWD/frameuniforms.h \
     $$PWD/mainwindow.h \
     $$PWD/mygl.h \
     $$PWD/scene/biomenoise.h \
     $$PWD/scene/blocktypeworker.h \
+    $$PWD/scene/chunkscheduler.h \
+    $$PWD/scene/workstealingpool.h \
+    $$PWD/scene/chunkmap.h \
+    $$PWD/scene/chunkring.h \
+    $$PWD/scene/renderregions.h \
+    $$PWD/scene/cullingboxes.h \
+    $$PWD/scene/mesharena.h \
+    $$PWD/scene/overdrawmeter.h \
     $$PWD/scene/camera.h \
     $$PWD/scene/chunk.h \
     $$PWD/scene/cube.h \
     $$PWD/scene/entity.h \
+    $$PWD/scene/noisetilecache.h \
+    $$PWD/scene/generationpipeline.h \
     $$PWD/scene/player.h \
     $$PWD/scene/quad.h \
     $$PWD/scene/rivers.h \
+    $$PWD/scene/riverregistry.h \
     $$PWD/scene/rivers.h \
     $$PWD/scene/saveloadworker.h \
     $$PWD/scene/saveloadworker.h \